@@ -0,0 +1,172 @@
+#ifndef BRICKEDVOLUME_H
+#define BRICKEDVOLUME_H
+
+#include "parallelFor.h"
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// A volume fraction field stored as bricks of BrickSize^3 cells. A brick
+// whose cells are all empty or all full is only flagged as such and reads
+// as exactly 0 or 1; the values of the other, mixed, bricks are kept as
+// float in brick order. Like the compressed field (see compressVof), the
+// values of empty and full cells are lost, everything else is exact. For
+// fields that are 0 or 1 almost everywhere the mixed bricks are a small
+// part of the grid.
+class BrickedVolume
+{
+public:
+  enum { BrickSize = 8 };
+  enum { EMPTY = 0, FULL = 1, MIXED = 2 };
+
+  BrickedVolume()
+  {
+    Res[0] = Res[1] = Res[2] = 0;
+    BrickRes[0] = BrickRes[1] = BrickRes[2] = 0;
+  }
+
+  // empty and full are thresholds in the units of the field, as for
+  // OccupancyMask: a cell is empty if its value is <= empty and full if it
+  // is >= full. Stored values are scaled by scale
+  template<typename T>
+  void Build(const T *field, const int res[3], const double empty,
+	     const double full, const float scale, const int numThreads)
+  {
+    for (int c = 0; c < 3; ++c) {
+      Res[c] = res[c];
+      BrickRes[c] = (res[c] + BrickSize - 1)/BrickSize;
+    }
+    const size_t numBricks = size_t(BrickRes[0])*BrickRes[1]*BrickRes[2];
+    Flags.assign(numBricks, EMPTY);
+    Offsets.assign(numBricks, -1);
+
+    // classify, in parallel over the bricks
+    parallelFor(numThreads, numBricks, 64,
+		[&](size_t begin, size_t end, int) {
+      for (size_t b = begin; b < end; ++b) {
+	int lo[3], hi[3];
+	GetBrickCells(b, lo, hi);
+	bool anyEmpty = false;
+	bool anyFull = false;
+	bool mixed = false;
+	for (int k = lo[2]; k < hi[2] && !mixed; ++k) {
+	  for (int j = lo[1]; j < hi[1] && !mixed; ++j) {
+	    const T *row = field + (size_t(k)*Res[1] + j)*Res[0];
+	    for (int i = lo[0]; i < hi[0]; ++i) {
+	      const double v = row[i];
+	      anyEmpty |= v <= empty;
+	      anyFull |= v >= full;
+	      if ((v > empty && v < full) || (anyEmpty && anyFull)) {
+		mixed = true;
+		break;
+	      }
+	    }
+	  }
+	}
+	Flags[b] = mixed ? MIXED : (anyFull ? FULL : EMPTY);
+      }
+    });
+
+    int numMixed = 0;
+    for (size_t b = 0; b < numBricks; ++b) {
+      if (Flags[b] == MIXED) {
+	Offsets[b] = numMixed++;
+      }
+    }
+    Values.assign(size_t(numMixed)*BrickVolume, 0.0f);
+
+    // copy the values of the mixed bricks
+    parallelFor(numThreads, numBricks, 64,
+		[&](size_t begin, size_t end, int) {
+      for (size_t b = begin; b < end; ++b) {
+	if (Offsets[b] < 0) {
+	  continue;
+	}
+	float *dst = &Values[size_t(Offsets[b])*BrickVolume];
+	int lo[3], hi[3];
+	GetBrickCells(b, lo, hi);
+	for (int k = lo[2]; k < hi[2]; ++k) {
+	  for (int j = lo[1]; j < hi[1]; ++j) {
+	    const T *row = field + (size_t(k)*Res[1] + j)*Res[0];
+	    for (int i = lo[0]; i < hi[0]; ++i) {
+	      dst[Local(i, j, k)] = row[i]*scale;
+	    }
+	  }
+	}
+      }
+    });
+  }
+
+  void Clear()
+  {
+    Res[0] = Res[1] = Res[2] = 0;
+    BrickRes[0] = BrickRes[1] = BrickRes[2] = 0;
+    Flags.clear();
+    Offsets.clear();
+    Values.clear();
+  }
+
+  bool IsEmpty() const { return Flags.empty(); }
+  const int *GetRes() const { return Res; }
+  const int *GetBrickRes() const { return BrickRes; }
+  size_t GetNumberOfMixedBricks() const { return Values.size()/BrickVolume; }
+  size_t GetMemorySize() const
+  {
+    return Flags.size()*sizeof(unsigned char) + Offsets.size()*sizeof(int) +
+      Values.size()*sizeof(float);
+  }
+
+  // EMPTY, FULL or MIXED
+  int GetFlag(const int bi, const int bj, const int bk) const
+  {
+    return Flags[bi + (size_t(bk)*BrickRes[1] + bj)*BrickRes[0]];
+  }
+
+  float Value(const int i, const int j, const int k) const
+  {
+    const size_t b = i/BrickSize +
+      (size_t(k/BrickSize)*BrickRes[1] + j/BrickSize)*BrickRes[0];
+    const int offset = Offsets[b];
+    if (offset >= 0) {
+      return Values[size_t(offset)*BrickVolume + Local(i, j, k)];
+    }
+    return Flags[b] == FULL ? 1.0f : 0.0f;
+  }
+  // value of the cell with index idx in x-fastest order
+  float Value(const size_t idx) const
+  {
+    const int i = idx%Res[0];
+    const int j = (idx/Res[0])%Res[1];
+    const int k = idx/(size_t(Res[0])*Res[1]);
+    return Value(i, j, k);
+  }
+
+private:
+  enum { BrickVolume = BrickSize*BrickSize*BrickSize };
+
+  static int Local(const int i, const int j, const int k)
+  {
+    return (i%BrickSize) + ((j%BrickSize) + (k%BrickSize)*BrickSize)*BrickSize;
+  }
+
+  // cells [lo,hi) of brick b, clipped to the grid
+  void GetBrickCells(const size_t b, int lo[3], int hi[3]) const
+  {
+    const int bi = b%BrickRes[0];
+    const int bj = (b/BrickRes[0])%BrickRes[1];
+    const int bk = b/(size_t(BrickRes[0])*BrickRes[1]);
+    const int brick[3] = {bi, bj, bk};
+    for (int c = 0; c < 3; ++c) {
+      lo[c] = brick[c]*BrickSize;
+      hi[c] = std::min(lo[c] + BrickSize, Res[c]);
+    }
+  }
+
+  int Res[3];
+  int BrickRes[3];
+  std::vector<unsigned char> Flags;
+  std::vector<int> Offsets; // of the mixed bricks in Values, else -1
+  std::vector<float> Values;
+};
+
+#endif//BRICKEDVOLUME_H
@@ -0,0 +1,135 @@
+#ifndef COMPONENTLABELING_H
+#define COMPONENTLABELING_H
+
+#include "parallelFor.h"
+#include "occupancyMask.h"
+#include <vector>
+#include <algorithm>
+
+// Connected components of the LIQUID cells of mask, connected over faces.
+// Labels are numbered from 0 in the order of the first cell of each
+// component in x-fastest order, empty cells get -1; returns the number of
+// labels.
+//
+// Union-find without recursion, so large components need no stack: the
+// grid is split into slabs along z that are labeled by different threads,
+// each linking a cell only to cells of its own slab, and the faces between
+// slabs are merged afterwards. Every cell is linked to a smaller index, so
+// the root of a component is its first cell, and one pass in index order
+// both flattens the trees and numbers the roots. Only the cells of the
+// mask are visited, 64 empty cells are skipped at once. Reentrant; the
+// labels do not depend on the number of threads.
+inline int labelComponents(const OccupancyMask &mask, const int numThreads,
+			   float *labels)
+{
+  const int *res = mask.GetRes();
+  const int sliceSize = res[0]*res[1];
+  const int numCells = sliceSize*res[2];
+  if (numCells <= 0) {
+    return 0;
+  }
+
+  // -1 for empty cells, else a cell with a smaller or the same index
+  std::vector<int> parent(numCells, -1);
+
+  struct Forest
+  {
+    std::vector<int> &parent;
+
+    int Find(int idx)
+    {
+      int root = idx;
+      while (parent[root] != root) {
+	root = parent[root];
+      }
+      while (parent[idx] != root) {
+	int next = parent[idx];
+	parent[idx] = root;
+	idx = next;
+      }
+      return root;
+    }
+
+    void Union(const int a, const int b)
+    {
+      const int ra = Find(a);
+      const int rb = Find(b);
+      if (ra < rb) {
+	parent[rb] = ra;
+      }
+      else if (rb < ra) {
+	parent[ra] = rb;
+      }
+    }
+  };
+
+  const int numSlabs = std::min(resolveNumThreads(numThreads), res[2]);
+  const int slabSize = (res[2] + numSlabs - 1)/numSlabs;
+
+  parallelFor(numThreads, res[2], slabSize,
+	      [&](size_t begin, size_t end, int) {
+    Forest forest = {parent};
+    const int first = begin;
+    const int last = end;
+    for (int k = first; k < last; ++k) {
+      for (int j = 0; j < res[1]; ++j) {
+	mask.ForEach(OccupancyMask::LIQUID, j, k, 0, res[0], [&](int i) {
+	  const int idx = i + j*res[0] + k*sliceSize;
+	  parent[idx] = idx;
+	  if (i > 0 && parent[idx-1] >= 0) {
+	    forest.Union(idx, idx-1);
+	  }
+	  if (j > 0 && parent[idx-res[0]] >= 0) {
+	    forest.Union(idx, idx-res[0]);
+	  }
+	  if (k > first && parent[idx-sliceSize] >= 0) {
+	    forest.Union(idx, idx-sliceSize);
+	  }
+	});
+      }
+    }
+  });
+
+  // faces between the slabs
+  Forest forest = {parent};
+  for (int k = slabSize; k < res[2]; k += slabSize) {
+    for (int j = 0; j < res[1]; ++j) {
+      mask.ForEach(OccupancyMask::LIQUID, j, k, 0, res[0], [&](int i) {
+	const int idx = i + j*res[0] + k*sliceSize;
+	if (parent[idx-sliceSize] >= 0) {
+	  forest.Union(idx, idx-sliceSize);
+	}
+      });
+    }
+  }
+
+  // parents precede their children, so their labels are already set
+  std::fill(labels, labels+numCells, -1.0f);
+  int numLabels = 0;
+  for (int k = 0; k < res[2]; ++k) {
+    for (int j = 0; j < res[1]; ++j) {
+      mask.ForEach(OccupancyMask::LIQUID, j, k, 0, res[0], [&](int i) {
+	const int idx = i + j*res[0] + k*sliceSize;
+	if (parent[idx] == idx) {
+	  labels[idx] = numLabels++;
+	}
+	else {
+	  labels[idx] = labels[parent[idx]];
+	}
+      });
+    }
+  }
+  return numLabels;
+}
+
+// components of the cells of field with a value above threshold
+template<typename T>
+int labelComponents(const T *field, const int res[3], const double threshold,
+		    const int numThreads, float *labels)
+{
+  OccupancyMask mask;
+  mask.Build(field, res, threshold, HUGE_VAL, numThreads);
+  return labelComponents(mask, numThreads, labels);
+}
+
+#endif//COMPONENTLABELING_H
@@ -0,0 +1,115 @@
+#ifndef FLOAT16_H
+#define FLOAT16_H
+
+#include <cstring>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// 16-bit storage types for fields that are read much more often than they
+// are written. Values are converted from float with round to nearest even
+// and read back as float, so all arithmetic stays in float. float16 is IEEE
+// half precision (11 bit mantissa, |x| <= 65504), bfloat16 keeps the range
+// of float with an 8 bit mantissa.
+
+struct float16
+{
+  unsigned short bits;
+
+  static float16 fromFloat(const float value)
+  {
+    float16 h;
+#if defined(__F16C__)
+    h.bits = _cvtss_sh(value, 0);
+#else
+    unsigned int x;
+    std::memcpy(&x, &value, sizeof(x));
+    const unsigned int sign = (x >> 16) & 0x8000;
+    const unsigned int absx = x & 0x7fffffff;
+
+    if (absx >= 0x7f800000) { // inf and nan
+      h.bits = sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+    }
+    else if (absx >= 0x477ff000) { // rounds to more than 65504
+      h.bits = sign | 0x7c00;
+    }
+    else if (absx >= 0x38800000) { // normal
+      unsigned int r = (absx - 0x38000000) >> 13;
+      const unsigned int rem = absx & 0x1fff;
+      if (rem > 0x1000 || (rem == 0x1000 && (r & 1))) {
+	++r;
+      }
+      h.bits = sign | r;
+    }
+    else if (absx > 0x33000000) { // subnormal
+      const unsigned int mant = (absx & 0x7fffff) | 0x800000;
+      const int shift = 126 - (absx >> 23);
+      unsigned int r = mant >> shift;
+      const unsigned int rem = mant & ((1u << shift) - 1);
+      const unsigned int half = 1u << (shift - 1);
+      if (rem > half || (rem == half && (r & 1))) {
+	++r;
+      }
+      h.bits = sign | r;
+    }
+    else {
+      h.bits = sign;
+    }
+#endif
+    return h;
+  }
+
+  operator float() const
+  {
+#if defined(__F16C__)
+    return _cvtsh_ss(bits);
+#else
+    const unsigned int sign = (bits & 0x8000u) << 16;
+    const unsigned int exponent = (bits >> 10) & 0x1f;
+    const unsigned int mant = bits & 0x3ff;
+    float value;
+    if (exponent == 0) {
+      value = mant*(1.0f/16777216.0f);
+      return sign ? -value : value;
+    }
+    unsigned int x;
+    if (exponent == 31) {
+      x = sign | 0x7f800000 | (mant << 13);
+    }
+    else {
+      x = sign | ((exponent + 112) << 23) | (mant << 13);
+    }
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+#endif
+  }
+};
+
+struct bfloat16
+{
+  unsigned short bits;
+
+  static bfloat16 fromFloat(const float value)
+  {
+    unsigned int x;
+    std::memcpy(&x, &value, sizeof(x));
+    bfloat16 b;
+    if ((x & 0x7fffffff) > 0x7f800000) { // keep nan a nan
+      b.bits = (x >> 16) | 0x40;
+    }
+    else {
+      b.bits = (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+    }
+    return b;
+  }
+
+  operator float() const
+  {
+    const unsigned int x = static_cast<unsigned int>(bits) << 16;
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+  }
+};
+
+#endif//FLOAT16_H
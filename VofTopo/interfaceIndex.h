@@ -0,0 +1,122 @@
+#ifndef INTERFACEINDEX_H
+#define INTERFACEINDEX_H
+
+#include "parallelFor.h"
+#include "occupancyMask.h"
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+
+// The interface cells of an occupancy mask (LIQUID but not FULL), as a
+// sorted list of cell indices in x-fastest order, and a bitmap of the
+// bricks of BrickSize^3 cells that hold any of them. Per-cell data of the
+// interface, like the PLIC planes, is stored in arrays parallel to the
+// list; since the list is sorted, a scan of the grid in index order finds
+// the slot of a cell by advancing a cursor, and Find looks up single
+// cells, rejecting cells of bricks without interface at once.
+class InterfaceIndex
+{
+public:
+  enum { BrickSize = 8 };
+
+  InterfaceIndex() : WordsPerLayer(0)
+  {
+    Res[0] = Res[1] = Res[2] = 0;
+    BrickRes[0] = BrickRes[1] = BrickRes[2] = 0;
+  }
+
+  void Build(const OccupancyMask &mask, const int numThreads)
+  {
+    const int *res = mask.GetRes();
+    for (int c = 0; c < 3; ++c) {
+      Res[c] = res[c];
+      BrickRes[c] = (res[c] + BrickSize - 1)/BrickSize;
+    }
+    WordsPerLayer = (BrickRes[0]*BrickRes[1] + 63)/64;
+    Bricks.assign(size_t(WordsPerLayer)*BrickRes[2], 0);
+    Cells.clear();
+
+    // chunks of whole layers of bricks, so the words of the bitmap and the
+    // cells of a layer are written by one thread
+    std::vector<std::vector<int> > layerCells(BrickRes[2]);
+    parallelFor(numThreads, Res[2], BrickSize,
+		[&](size_t begin, size_t end, int) {
+      const int words = mask.GetWordsPerRow();
+      for (int k = begin; k < int(end); ++k) {
+	std::vector<int> &cells = layerCells[k/BrickSize];
+	uint64_t *bricks = &Bricks[size_t(k/BrickSize)*WordsPerLayer];
+	for (int j = 0; j < Res[1]; ++j) {
+	  const uint64_t *liquid = mask.GetRow(OccupancyMask::LIQUID, j, k);
+	  const uint64_t *full = mask.GetRow(OccupancyMask::FULL, j, k);
+	  const int rowStart = (k*Res[1] + j)*Res[0];
+	  for (int w = 0; w < words; ++w) {
+	    uint64_t bits = liquid[w] & ~full[w];
+	    while (bits != 0) {
+	      const int i = w*64 + __builtin_ctzll(bits);
+	      cells.push_back(rowStart + i);
+	      const int brick = i/BrickSize + (j/BrickSize)*BrickRes[0];
+	      bricks[brick >> 6] |= uint64_t(1) << (brick & 63);
+	      bits &= bits-1;
+	    }
+	  }
+	}
+      }
+    });
+
+    size_t numCells = 0;
+    for (size_t l = 0; l < layerCells.size(); ++l) {
+      numCells += layerCells[l].size();
+    }
+    Cells.reserve(numCells);
+    for (size_t l = 0; l < layerCells.size(); ++l) {
+      Cells.insert(Cells.end(), layerCells[l].begin(), layerCells[l].end());
+    }
+  }
+
+  void Clear()
+  {
+    Res[0] = Res[1] = Res[2] = 0;
+    BrickRes[0] = BrickRes[1] = BrickRes[2] = 0;
+    WordsPerLayer = 0;
+    Cells.clear();
+    Bricks.clear();
+  }
+
+  const int *GetRes() const { return Res; }
+  size_t GetNumberOfCells() const { return Cells.size(); }
+  // sorted indices of the interface cells
+  const std::vector<int> &GetCells() const { return Cells; }
+  size_t GetMemorySize() const
+  {
+    return Cells.size()*sizeof(int) + Bricks.size()*sizeof(uint64_t);
+  }
+
+  // brick of BrickSize^3 cells starting at cell (bi,bj,bk)*BrickSize
+  bool BrickHasInterface(const int bi, const int bj, const int bk) const
+  {
+    const int brick = bi + bj*BrickRes[0];
+    return (Bricks[size_t(bk)*WordsPerLayer + (brick >> 6)] >> (brick & 63)) & 1;
+  }
+
+  // slot of cell (i,j,k) in GetCells(), -1 if it is no interface cell
+  int Find(const int i, const int j, const int k) const
+  {
+    if (!BrickHasInterface(i/BrickSize, j/BrickSize, k/BrickSize)) {
+      return -1;
+    }
+    const int idx = i + (j + k*Res[1])*Res[0];
+    std::vector<int>::const_iterator it =
+      std::lower_bound(Cells.begin(), Cells.end(), idx);
+    return it != Cells.end() && *it == idx ? int(it - Cells.begin()) : -1;
+  }
+
+private:
+  int Res[3];
+  int BrickRes[3];
+  int WordsPerLayer;
+  std::vector<int> Cells;
+  std::vector<uint64_t> Bricks; // WordsPerLayer words per layer of bricks
+};
+
+#endif//INTERFACEINDEX_H
@@ -0,0 +1,221 @@
+#ifndef OCCUPANCYMASK_H
+#define OCCUPANCYMASK_H
+
+#include "parallelFor.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Classification of the cells of a volume fraction field as empty,
+// interface or full, kept as two bit-planes: LIQUID has the cells above
+// the empty threshold, FULL the cells at or above the full threshold.
+// Interface cells are LIQUID but not FULL.
+//
+// Every x-row of the grid starts at a new 64-bit word, so a row is scanned
+// a word at a time and words without any cell of a plane are skipped. The
+// planes are built with SSE2 compares and movemask where available, in
+// parallel over the rows. The mask of a grid takes 1/16 of the memory of
+// a float field.
+class OccupancyMask
+{
+public:
+  enum { LIQUID = 0, FULL = 1 };
+
+  OccupancyMask() : WordsPerRow(0)
+  {
+    Res[0] = Res[1] = Res[2] = 0;
+  }
+
+  // empty and full are thresholds in the units of the field: a cell is
+  // LIQUID if its value is > empty and FULL if it is >= full
+  template<typename T>
+  void Build(const T *field, const int res[3], const double empty,
+	     const double full, const int numThreads)
+  {
+    Res[0] = res[0];
+    Res[1] = res[1];
+    Res[2] = res[2];
+    WordsPerRow = (res[0] + 63)/64;
+    const size_t numRows = size_t(res[1])*res[2];
+    for (int p = 0; p < 2; ++p) {
+      Planes[p].assign(numRows*WordsPerRow, 0);
+    }
+
+    parallelFor(numThreads, numRows, 64,
+		[&](size_t begin, size_t end, int) {
+      for (size_t r = begin; r < end; ++r) {
+	const T *row = field + r*res[0];
+	for (int w = 0; w < WordsPerRow; ++w) {
+	  const int n = std::min(64, res[0] - w*64);
+	  packWord(row + w*64, n, empty, full,
+		   Planes[LIQUID][r*WordsPerRow + w],
+		   Planes[FULL][r*WordsPerRow + w]);
+	}
+      }
+    });
+  }
+
+  void Clear()
+  {
+    Res[0] = Res[1] = Res[2] = 0;
+    WordsPerRow = 0;
+    Planes[LIQUID].clear();
+    Planes[FULL].clear();
+  }
+
+  bool IsEmpty() const { return Planes[LIQUID].empty(); }
+  const int *GetRes() const { return Res; }
+  int GetWordsPerRow() const { return WordsPerRow; }
+  size_t GetMemorySize() const
+  {
+    return (Planes[LIQUID].size() + Planes[FULL].size())*sizeof(uint64_t);
+  }
+
+  const uint64_t *GetRow(const int plane, const int j, const int k) const
+  {
+    return &Planes[plane][(size_t(k)*Res[1] + j)*WordsPerRow];
+  }
+
+  bool Test(const int plane, const int i, const int j, const int k) const
+  {
+    return (GetRow(plane, j, k)[i >> 6] >> (i & 63)) & 1;
+  }
+  bool IsLiquid(const int i, const int j, const int k) const
+  {
+    return Test(LIQUID, i, j, k);
+  }
+  bool IsFull(const int i, const int j, const int k) const
+  {
+    return Test(FULL, i, j, k);
+  }
+
+  // interface cells and full cells with an empty face neighbor; cells
+  // outside the grid do not count as empty
+  bool OnInterface(const int i, const int j, const int k) const
+  {
+    if (!IsLiquid(i, j, k)) {
+      return false;
+    }
+    if (!IsFull(i, j, k)) {
+      return true;
+    }
+    return ((i > 0 && !IsLiquid(i-1, j, k)) ||
+	    (i+1 < Res[0] && !IsLiquid(i+1, j, k)) ||
+	    (j > 0 && !IsLiquid(i, j-1, k)) ||
+	    (j+1 < Res[1] && !IsLiquid(i, j+1, k)) ||
+	    (k > 0 && !IsLiquid(i, j, k-1)) ||
+	    (k+1 < Res[2] && !IsLiquid(i, j, k+1)));
+  }
+
+  // calls fn(i) in increasing order for the cells of plane in [imin,imax)
+  // of row (j,k)
+  template<typename F>
+  void ForEach(const int plane, const int j, const int k, const int imin,
+	       const int imax, F fn) const
+  {
+    if (imin >= imax) {
+      return;
+    }
+    const uint64_t *row = GetRow(plane, j, k);
+    const int wmin = imin >> 6;
+    const int wmax = (imax-1) >> 6;
+    for (int w = wmin; w <= wmax; ++w) {
+      uint64_t bits = row[w];
+      if (w == wmin) {
+	bits &= ~uint64_t(0) << (imin & 63);
+      }
+      if (w == wmax && (imax & 63) != 0) {
+	bits &= ~(~uint64_t(0) << (imax & 63));
+      }
+      while (bits != 0) {
+	fn(w*64 + __builtin_ctzll(bits));
+	bits &= bits-1;
+      }
+    }
+  }
+
+private:
+
+  static void packWord(const float *src, const int n, const double empty,
+		       const double full, uint64_t &liquid, uint64_t &fullBits)
+  {
+    // float thresholds that classify like the double ones
+    float fe = float(empty);
+    if (fe > empty) {
+      fe = std::nextafter(fe, -HUGE_VALF);
+    }
+    float ff = float(full);
+    if (ff < full) {
+      ff = std::nextafter(ff, HUGE_VALF);
+    }
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 e = _mm_set1_ps(fe);
+    const __m128 f = _mm_set1_ps(ff);
+    for (; i+4 <= n; i += 4) {
+      const __m128 v = _mm_loadu_ps(src+i);
+      liquid |= uint64_t(_mm_movemask_ps(_mm_cmpgt_ps(v, e))) << i;
+      fullBits |= uint64_t(_mm_movemask_ps(_mm_cmpge_ps(v, f))) << i;
+    }
+#endif
+    for (; i < n; ++i) {
+      liquid |= uint64_t(src[i] > fe) << i;
+      fullBits |= uint64_t(src[i] >= ff) << i;
+    }
+  }
+
+  static void packWord(const double *src, const int n, const double empty,
+		       const double full, uint64_t &liquid, uint64_t &fullBits)
+  {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128d e = _mm_set1_pd(empty);
+    const __m128d f = _mm_set1_pd(full);
+    for (; i+2 <= n; i += 2) {
+      const __m128d v = _mm_loadu_pd(src+i);
+      liquid |= uint64_t(_mm_movemask_pd(_mm_cmpgt_pd(v, e))) << i;
+      fullBits |= uint64_t(_mm_movemask_pd(_mm_cmpge_pd(v, f))) << i;
+    }
+#endif
+    for (; i < n; ++i) {
+      liquid |= uint64_t(src[i] > empty) << i;
+      fullBits |= uint64_t(src[i] >= full) << i;
+    }
+  }
+
+  // integer values: v > empty is v > floor(empty), v >= full is
+  // v > ceil(full)-1
+  static void packWord(const signed char *src, const int n,
+		       const double empty, const double full,
+		       uint64_t &liquid, uint64_t &fullBits)
+  {
+    const int e = std::max(std::min(std::floor(empty), 127.0), -128.0);
+    const int f = std::max(std::min(std::ceil(full)-1.0, 127.0), -128.0);
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i ev = _mm_set1_epi8(char(e));
+    const __m128i fv = _mm_set1_epi8(char(f));
+    for (; i+16 <= n; i += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+      liquid |= uint64_t(_mm_movemask_epi8(_mm_cmpgt_epi8(v, ev))) << i;
+      fullBits |= uint64_t(_mm_movemask_epi8(_mm_cmpgt_epi8(v, fv))) << i;
+    }
+#endif
+    for (; i < n; ++i) {
+      liquid |= uint64_t(src[i] > e) << i;
+      fullBits |= uint64_t(src[i] > f) << i;
+    }
+  }
+
+  int Res[3];
+  int WordsPerRow;
+  std::vector<uint64_t> Planes[2];
+};
+
+#endif//OCCUPANCYMASK_H
@@ -0,0 +1,66 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// numThreads <= 0 means "use all hardware threads"
+inline int resolveNumThreads(int numThreads)
+{
+  if (numThreads > 0) {
+    return numThreads;
+  }
+  int hw = std::thread::hardware_concurrency();
+  return hw > 0 ? hw : 1;
+}
+
+// Calls fn(begin, end, threadId) on consecutive chunks of [0,n). Chunks are
+// handed out from a shared counter, so a thread that gets cheap work
+// (e.g. dead particles) simply picks up more chunks. Every element is
+// processed exactly once by exactly one thread, so kernels that only write
+// to their own elements give the same result for any thread count.
+template<typename F>
+void parallelFor(int numThreads, size_t n, size_t chunkSize, F fn)
+{
+  if (n == 0) {
+    return;
+  }
+  if (chunkSize == 0) {
+    chunkSize = 1;
+  }
+  numThreads = resolveNumThreads(numThreads);
+  size_t numChunks = (n + chunkSize - 1)/chunkSize;
+  if (numChunks < static_cast<size_t>(numThreads)) {
+    numThreads = numChunks;
+  }
+
+  if (numThreads == 1) {
+    fn(size_t(0), n, 0);
+    return;
+  }
+
+  std::atomic<size_t> nextChunk(0);
+  auto worker = [&](int threadId) {
+    size_t c;
+    while ((c = nextChunk.fetch_add(1)) < numChunks) {
+      size_t begin = c*chunkSize;
+      size_t end = std::min(begin + chunkSize, n);
+      fn(begin, end, threadId);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads-1);
+  for (int t = 1; t < numThreads; ++t) {
+    threads.push_back(std::thread(worker, t));
+  }
+  worker(0);
+  for (size_t t = 0; t < threads.size(); ++t) {
+    threads[t].join();
+  }
+}
+
+#endif//PARALLELFOR_H
@@ -0,0 +1,161 @@
+#ifndef RECTILINEARLOCATOR_H
+#define RECTILINEARLOCATOR_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Finds the cell containing a point in a rectilinear grid in O(1).
+//
+// Built once per grid from the node coordinates of each axis. For uniformly
+// spaced axes the cell index is computed directly, for non-uniform axes a
+// bucket table maps equally sized intervals to the first cell overlapping
+// them. In both cases the guess is corrected against the actual
+// coordinates, so the result is exact (same cell and parametric coordinates
+// as vtkRectilinearGrid::ComputeStructuredCoordinates for points inside).
+// Points outside the grid are clamped to the closest boundary cell with
+// parametric coordinates in [0,1], and FindCell returns false.
+class RectilinearLocator
+{
+public:
+  RectilinearLocator() {}
+
+  template<typename T>
+  void SetAxis(const int axis, const T *coords, const int numCoords)
+  {
+    Axis &a = Axes[axis];
+    a.coords.assign(coords, coords + numCoords);
+    a.buckets.clear();
+    a.uniform = true;
+    a.invWidth = 0.0;
+
+    if (numCoords < 2) {
+      return;
+    }
+
+    const int numCells = numCoords-1;
+    const double first = a.coords.front();
+    const double last = a.coords.back();
+    const double spacing = (last - first)/numCells;
+
+    for (int i = 0; i < numCells && a.uniform; ++i) {
+      double d = a.coords[i+1] - a.coords[i];
+      if (std::abs(d - spacing) > 1e-4*std::abs(spacing)) {
+	a.uniform = false;
+      }
+    }
+
+    if (last == first) {
+      return;
+    }
+    if (a.uniform) {
+      a.invWidth = 1.0/spacing;
+      return;
+    }
+
+    // twice as many buckets as cells keeps the walk short even when the
+    // cell sizes vary strongly
+    const int numBuckets = 2*numCells;
+    a.invWidth = numBuckets/(last - first);
+    a.buckets.resize(numBuckets+1);
+    int cell = 0;
+    for (int b = 0; b <= numBuckets; ++b) {
+      double x = first + b/a.invWidth;
+      while (cell < numCells-1 && x >= a.coords[cell+1]) {
+	++cell;
+      }
+      a.buckets[b] = cell;
+    }
+  }
+
+  template<typename T>
+  void SetCoordinates(const T *xcoords, const T *ycoords, const T *zcoords,
+		      const int nodeRes[3])
+  {
+    SetAxis(0, xcoords, nodeRes[0]);
+    SetAxis(1, ycoords, nodeRes[1]);
+    SetAxis(2, zcoords, nodeRes[2]);
+  }
+
+  int GetNumberOfNodes(const int axis) const
+  {
+    return Axes[axis].coords.size();
+  }
+
+  const std::vector<double> &GetCoordinates(const int axis) const
+  {
+    return Axes[axis].coords;
+  }
+
+  // returns true if x lies inside the grid
+  template<typename T>
+  bool FindCell(const T x[3], int ijk[3], T pcoords[3]) const
+  {
+    bool inside = true;
+    for (int c = 0; c < 3; ++c) {
+      double p;
+      inside &= Axes[c].Find(x[c], ijk[c], p);
+      pcoords[c] = p;
+    }
+    return inside;
+  }
+
+private:
+
+  struct Axis
+  {
+    std::vector<double> coords;
+    std::vector<int> buckets;
+    bool uniform;
+    double invWidth;
+
+    Axis() : uniform(true), invWidth(0.0) {}
+
+    bool Find(const double x, int &i, double &p) const
+    {
+      const int numCoords = coords.size();
+      if (numCoords < 2) {
+	i = 0;
+	p = 0.0;
+	return numCoords == 1 && x == coords[0];
+      }
+      const int numCells = numCoords-1;
+      const double first = coords[0];
+      const double last = coords[numCells];
+
+      if (!(x >= first)) { // also catches NaN
+	i = 0;
+	p = 0.0;
+	return false;
+      }
+      if (x >= last) {
+	i = numCells-1;
+	p = 1.0;
+	return x == last;
+      }
+
+      double g = (x - first)*invWidth;
+      if (uniform) {
+	i = std::min(static_cast<int>(g), numCells-1);
+      }
+      else {
+	int b = std::min(static_cast<int>(g), static_cast<int>(buckets.size())-1);
+	i = buckets[b];
+      }
+      // correct the guess (needed for rounding and in buckets spanning
+      // several cells)
+      while (i < numCells-1 && x >= coords[i+1]) {
+	++i;
+      }
+      while (i > 0 && x < coords[i]) {
+	--i;
+      }
+      p = (x - coords[i])/(coords[i+1] - coords[i]);
+      return true;
+    }
+  };
+
+  Axis Axes[3];
+};
+
+#endif//RECTILINEARLOCATOR_H
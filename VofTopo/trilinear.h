@@ -0,0 +1,333 @@
+#ifndef TRILINEAR_H
+#define TRILINEAR_H
+
+#include <cstddef>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Batched trilinear interpolation on raw arrays.
+//
+// Particles are given as cell indices and parametric coordinates inside the
+// cell, as returned by RectilinearLocator::FindCell, one array per axis.
+// The field is either sampled at the grid nodes (TRILINEAR_NODES, res is
+// the node resolution) or at the cell centers (TRILINEAR_CELLS, res is the
+// cell resolution; the stencil is shifted by half a cell and clamped at the
+// boundary). Fields with more than one component are interleaved, and the
+// result of component c is written to out[c].
+//
+// Float fields are interpolated eight particles at once with AVX2 and four
+// at once with SSE2; the remaining particles and other field types use the
+// scalar code. All paths do the same float operations in the same order.
+// gatherCellBatch looks up the values of the cells themselves, e.g. for
+// the volume fraction test of advected particles.
+enum {
+  TRILINEAR_NODES = 0,
+  TRILINEAR_CELLS = 1
+};
+
+namespace trilinear_detail
+{
+  template<int Mode>
+  inline void setupAxis(const int cell, const float p, const int res,
+			int &lo, int &up, float &w)
+  {
+    if (Mode == TRILINEAR_CELLS) {
+      lo = cell;
+      w = p - 0.5f;
+      if (p < 0.5f) {
+	lo = cell - 1;
+	w = p + 0.5f;
+      }
+      up = lo + 1;
+      if (lo < 0) lo = 0;
+      if (up > res-1) up = res-1;
+    }
+    else {
+      lo = cell;
+      up = cell + 1;
+      w = p;
+    }
+  }
+
+  template<int Mode, int NumComp, typename T>
+  inline void interpolate(const T *field, const int res[3],
+			  const int cell[3], const float pcoords[3],
+			  float out[NumComp])
+  {
+    int lo[3], up[3];
+    float w[3];
+    for (int a = 0; a < 3; ++a) {
+      setupAxis<Mode>(cell[a], pcoords[a], res[a], lo[a], up[a], w[a]);
+    }
+    const size_t sx = res[0];
+    const size_t sxy = sx*res[1];
+    const size_t id[8] = {lo[0] + lo[1]*sx + lo[2]*sxy,
+			  up[0] + lo[1]*sx + lo[2]*sxy,
+			  lo[0] + up[1]*sx + lo[2]*sxy,
+			  up[0] + up[1]*sx + lo[2]*sxy,
+			  lo[0] + lo[1]*sx + up[2]*sxy,
+			  up[0] + lo[1]*sx + up[2]*sxy,
+			  lo[0] + up[1]*sx + up[2]*sxy,
+			  up[0] + up[1]*sx + up[2]*sxy};
+    const float x = w[0];
+    const float y = w[1];
+    const float z = w[2];
+
+    for (int c = 0; c < NumComp; ++c) {
+      float v[8];
+      for (int n = 0; n < 8; ++n) {
+	v[n] = field[id[n]*NumComp+c];
+      }
+      float a = (1.0f-x)*v[0] + x*v[1];
+      float b = (1.0f-x)*v[2] + x*v[3];
+      float d0 = (1.0f-y)*a + y*b;
+      a = (1.0f-x)*v[4] + x*v[5];
+      b = (1.0f-x)*v[6] + x*v[7];
+      float d1 = (1.0f-y)*a + y*b;
+      out[c] = (1.0f-z)*d0 + z*d1;
+    }
+  }
+
+  // vectorized part of a batch, returns the number of particles done
+  template<int Mode, int NumComp, typename T>
+  struct SimdBatch
+  {
+    static size_t run(const T *, const int [3], const size_t,
+		      const int *const [3], const float *const [3],
+		      float *const [NumComp])
+    {
+      return 0;
+    }
+  };
+
+#if defined(__AVX2__)
+  template<int Mode, int NumComp>
+  struct SimdBatch<Mode, NumComp, float>
+  {
+    static size_t run(const float *field, const int res[3], const size_t n,
+		      const int *const cell[3], const float *const pcoords[3],
+		      float *const out[NumComp])
+    {
+      // gathers use 32-bit offsets
+      if (double(res[0])*res[1]*res[2]*NumComp >= 2147483647.0) {
+	return 0;
+      }
+      const __m256 one = _mm256_set1_ps(1.0f);
+      const __m256 half = _mm256_set1_ps(0.5f);
+      const __m256i ione = _mm256_set1_epi32(1);
+      const __m256i izero = _mm256_setzero_si256();
+      const __m256i sx = _mm256_set1_epi32(res[0]);
+      const __m256i sxy = _mm256_set1_epi32(res[0]*res[1]);
+      const __m256i ncomp = _mm256_set1_epi32(NumComp);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+
+	__m256i lo[3], up[3];
+	__m256 w[3];
+	for (int a = 0; a < 3; ++a) {
+	  __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cell[a]+i));
+	  __m256 p = _mm256_loadu_ps(pcoords[a]+i);
+	  if (Mode == TRILINEAR_CELLS) {
+	    __m256 below = _mm256_cmp_ps(p, half, _CMP_LT_OQ);
+	    w[a] = _mm256_blendv_ps(_mm256_sub_ps(p, half), _mm256_add_ps(p, half), below);
+	    // the mask is -1 where p < 0.5
+	    lo[a] = _mm256_add_epi32(c, _mm256_castps_si256(below));
+	    up[a] = _mm256_add_epi32(lo[a], ione);
+	    lo[a] = _mm256_max_epi32(lo[a], izero);
+	    up[a] = _mm256_min_epi32(up[a], _mm256_set1_epi32(res[a]-1));
+	  }
+	  else {
+	    lo[a] = c;
+	    up[a] = _mm256_add_epi32(c, ione);
+	    w[a] = p;
+	  }
+	}
+	__m256i ly = _mm256_mullo_epi32(lo[1], sx);
+	__m256i uy = _mm256_mullo_epi32(up[1], sx);
+	__m256i lz = _mm256_mullo_epi32(lo[2], sxy);
+	__m256i uz = _mm256_mullo_epi32(up[2], sxy);
+	__m256i id[8] = {_mm256_add_epi32(_mm256_add_epi32(lo[0], ly), lz),
+			 _mm256_add_epi32(_mm256_add_epi32(up[0], ly), lz),
+			 _mm256_add_epi32(_mm256_add_epi32(lo[0], uy), lz),
+			 _mm256_add_epi32(_mm256_add_epi32(up[0], uy), lz),
+			 _mm256_add_epi32(_mm256_add_epi32(lo[0], ly), uz),
+			 _mm256_add_epi32(_mm256_add_epi32(up[0], ly), uz),
+			 _mm256_add_epi32(_mm256_add_epi32(lo[0], uy), uz),
+			 _mm256_add_epi32(_mm256_add_epi32(up[0], uy), uz)};
+	if (NumComp > 1) {
+	  for (int k = 0; k < 8; ++k) {
+	    id[k] = _mm256_mullo_epi32(id[k], ncomp);
+	  }
+	}
+	const __m256 x = w[0];
+	const __m256 y = w[1];
+	const __m256 z = w[2];
+	const __m256 mx = _mm256_sub_ps(one, x);
+	const __m256 my = _mm256_sub_ps(one, y);
+	const __m256 mz = _mm256_sub_ps(one, z);
+
+	for (int c = 0; c < NumComp; ++c) {
+	  __m256 v[8];
+	  for (int k = 0; k < 8; ++k) {
+	    v[k] = _mm256_i32gather_ps(field + c, id[k], 4);
+	  }
+	  __m256 a = _mm256_add_ps(_mm256_mul_ps(mx, v[0]), _mm256_mul_ps(x, v[1]));
+	  __m256 b = _mm256_add_ps(_mm256_mul_ps(mx, v[2]), _mm256_mul_ps(x, v[3]));
+	  __m256 d0 = _mm256_add_ps(_mm256_mul_ps(my, a), _mm256_mul_ps(y, b));
+	  a = _mm256_add_ps(_mm256_mul_ps(mx, v[4]), _mm256_mul_ps(x, v[5]));
+	  b = _mm256_add_ps(_mm256_mul_ps(mx, v[6]), _mm256_mul_ps(x, v[7]));
+	  __m256 d1 = _mm256_add_ps(_mm256_mul_ps(my, a), _mm256_mul_ps(y, b));
+	  _mm256_storeu_ps(out[c]+i, _mm256_add_ps(_mm256_mul_ps(mz, d0),
+						   _mm256_mul_ps(z, d1)));
+	}
+      }
+      return i;
+    }
+  };
+#elif defined(__SSE2__)
+  // SSE2 has no gathers and no 32-bit multiplies, so the stencil is set up
+  // per particle and only the interpolation is vectorized
+  template<int Mode, int NumComp>
+  struct SimdBatch<Mode, NumComp, float>
+  {
+    static size_t run(const float *field, const int res[3], const size_t n,
+		      const int *const cell[3], const float *const pcoords[3],
+		      float *const out[NumComp])
+    {
+      const __m128 one = _mm_set1_ps(1.0f);
+      const size_t sx = res[0];
+      const size_t sxy = sx*res[1];
+
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4) {
+
+	int lo[3][4], up[3][4];
+	float w[3][4];
+	size_t id[8][4];
+	for (int l = 0; l < 4; ++l) {
+	  for (int a = 0; a < 3; ++a) {
+	    setupAxis<Mode>(cell[a][i+l], pcoords[a][i+l], res[a],
+			    lo[a][l], up[a][l], w[a][l]);
+	  }
+	  id[0][l] = (lo[0][l] + lo[1][l]*sx + lo[2][l]*sxy)*NumComp;
+	  id[1][l] = (up[0][l] + lo[1][l]*sx + lo[2][l]*sxy)*NumComp;
+	  id[2][l] = (lo[0][l] + up[1][l]*sx + lo[2][l]*sxy)*NumComp;
+	  id[3][l] = (up[0][l] + up[1][l]*sx + lo[2][l]*sxy)*NumComp;
+	  id[4][l] = (lo[0][l] + lo[1][l]*sx + up[2][l]*sxy)*NumComp;
+	  id[5][l] = (up[0][l] + lo[1][l]*sx + up[2][l]*sxy)*NumComp;
+	  id[6][l] = (lo[0][l] + up[1][l]*sx + up[2][l]*sxy)*NumComp;
+	  id[7][l] = (up[0][l] + up[1][l]*sx + up[2][l]*sxy)*NumComp;
+	}
+	const __m128 x = _mm_loadu_ps(w[0]);
+	const __m128 y = _mm_loadu_ps(w[1]);
+	const __m128 z = _mm_loadu_ps(w[2]);
+	const __m128 mx = _mm_sub_ps(one, x);
+	const __m128 my = _mm_sub_ps(one, y);
+	const __m128 mz = _mm_sub_ps(one, z);
+
+	for (int c = 0; c < NumComp; ++c) {
+	  __m128 v[8];
+	  for (int k = 0; k < 8; ++k) {
+	    v[k] = _mm_set_ps(field[id[k][3]+c], field[id[k][2]+c],
+			      field[id[k][1]+c], field[id[k][0]+c]);
+	  }
+	  __m128 a = _mm_add_ps(_mm_mul_ps(mx, v[0]), _mm_mul_ps(x, v[1]));
+	  __m128 b = _mm_add_ps(_mm_mul_ps(mx, v[2]), _mm_mul_ps(x, v[3]));
+	  __m128 d0 = _mm_add_ps(_mm_mul_ps(my, a), _mm_mul_ps(y, b));
+	  a = _mm_add_ps(_mm_mul_ps(mx, v[4]), _mm_mul_ps(x, v[5]));
+	  b = _mm_add_ps(_mm_mul_ps(mx, v[6]), _mm_mul_ps(x, v[7]));
+	  __m128 d1 = _mm_add_ps(_mm_mul_ps(my, a), _mm_mul_ps(y, b));
+	  _mm_storeu_ps(out[c]+i, _mm_add_ps(_mm_mul_ps(mz, d0),
+					     _mm_mul_ps(z, d1)));
+	}
+      }
+      return i;
+    }
+  };
+#endif
+
+  template<typename T>
+  struct SimdGather
+  {
+    static size_t run(const T *, const int [3], const size_t,
+		      const int *const [3], float *)
+    {
+      return 0;
+    }
+  };
+
+#if defined(__AVX2__)
+  template<>
+  struct SimdGather<float>
+  {
+    static size_t run(const float *field, const int res[3], const size_t n,
+		      const int *const cell[3], float *out)
+    {
+      if (double(res[0])*res[1]*res[2] >= 2147483647.0) {
+	return 0;
+      }
+      const __m256i sx = _mm256_set1_epi32(res[0]);
+      const __m256i sxy = _mm256_set1_epi32(res[0]*res[1]);
+
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+	__m256i ci = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cell[0]+i));
+	__m256i cj = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cell[1]+i));
+	__m256i ck = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cell[2]+i));
+	__m256i id = _mm256_add_epi32(_mm256_add_epi32(ci, _mm256_mullo_epi32(cj, sx)),
+				      _mm256_mullo_epi32(ck, sxy));
+	_mm256_storeu_ps(out+i, _mm256_i32gather_ps(field, id, 4));
+      }
+      return i;
+    }
+  };
+#endif
+}
+
+// interpolates n particles
+template<int Mode, int NumComp, typename T>
+void trilinearBatch(const T *field, const int res[3], const size_t n,
+		    const int *const cell[3], const float *const pcoords[3],
+		    float *const out[NumComp])
+{
+  size_t i = trilinear_detail::SimdBatch<Mode, NumComp, T>::
+    run(field, res, n, cell, pcoords, out);
+
+  for (; i < n; ++i) {
+    int c[3] = {cell[0][i], cell[1][i], cell[2][i]};
+    float p[3] = {pcoords[0][i], pcoords[1][i], pcoords[2][i]};
+    float o[NumComp];
+    trilinear_detail::interpolate<Mode, NumComp>(field, res, c, p, o);
+    for (int k = 0; k < NumComp; ++k) {
+      out[k][i] = o[k];
+    }
+  }
+}
+
+// interpolates a single particle with the scalar code
+template<int Mode, int NumComp, typename T>
+inline void trilinear(const T *field, const int res[3], const int cell[3],
+		      const float pcoords[3], float out[NumComp])
+{
+  trilinear_detail::interpolate<Mode, NumComp>(field, res, cell, pcoords, out);
+}
+
+// values of the cells of n particles
+template<typename T>
+void gatherCellBatch(const T *field, const int res[3], const size_t n,
+		     const int *const cell[3], float *out)
+{
+  size_t i = trilinear_detail::SimdGather<T>::run(field, res, n, cell, out);
+
+  const size_t sx = res[0];
+  const size_t sxy = sx*res[1];
+  for (; i < n; ++i) {
+    out[i] = field[cell[0][i] + cell[1][i]*sx + cell[2][i]*sxy];
+  }
+}
+
+#endif//TRILINEAR_H
@@ -19,6 +19,7 @@
 #include <map>
 
 #include "helper_math.h"
+#include "componentLabeling.h"
 
 vtkStandardNewMacro(vtkVofComponents);
 
@@ -122,89 +123,6 @@ void findNeighbors(const int localExtents[6],
 }
 
 static const double g_emf0 = 0.000001;
-static int g_res[3];
-static int g_labelId = 0;
-
-template<typename T>
-static void grow(std::vector<T> &data, const int &idx,
-		 std::vector<float> &labels)
-{
-  T tmp = data[idx];
-
-  if (tmp <= g_emf0) {
-    return;
-  }
-
-  labels[idx] = g_labelId;
-  data[idx] = 0.0;
-
-  int i = idx%g_res[0];
-  int j = (idx/g_res[0])%g_res[1];
-  int k = idx/(g_res[0]*g_res[1]);
-
-  if (i + 1 < g_res[0]) {
-    grow(data, idx+1, labels);
-  }
-  if (i > 0) {
-    grow(data, idx-1, labels);
-  }
-  if (j + 1 < g_res[1]) {
-    grow(data, idx+g_res[0], labels);
-  }
-  if (j > 0) {
-    grow(data, idx-g_res[0], labels);
-  }
-  if (k + 1 < g_res[2]) {
-    grow(data, idx+g_res[0]*g_res[1], labels);
-  }
-  if (k > 0) {
-    grow(data, idx-g_res[0]*g_res[1], labels);
-  }
-}
-
-template<typename T>
-static bool extractComponents_pred(T f)
-{
-  return f > g_emf0;
-}
-
-template<typename T>
-static void extractComponents(const T *vofField,
-			      const int res[3],
-			      float *labelField)
-{
-  g_res[0] = res[0];
-  g_res[1] = res[1];
-  g_res[2] = res[2];
-
-  int numCells = res[0]*res[1]*res[2];
-  std::vector<T> fieldTmp(vofField, vofField+numCells);
-  std::vector<float> labelFieldTmp(numCells, -1.0f);
-
-  int i = 0;
-  while (i < numCells) {
-
-    typename std::vector<T>::iterator it =
-      std::find_if(fieldTmp.begin()+i, fieldTmp.end(),
-		   extractComponents_pred<T>);
-
-    if (it == fieldTmp.end()) {
-      break;
-    }
-
-    int idx = it - fieldTmp.begin();
-
-    if (idx > i) {
-      i = idx;
-    }
-    else {
-      ++i;
-    }
-    grow(fieldTmp, idx, labelFieldTmp);
-    ++g_labelId;
-  }
-  std::copy(labelFieldTmp.begin(), labelFieldTmp.end(), labelField);
-}
 
 static
 void unifyLabelsInProcess(std::vector<std::vector<int> > &NeighborProcesses,
@@ -433,15 +351,17 @@ void vtkVofComponents::ExtractComponents(vtkRectilinearGrid *vof,
     labels->SetValue(i, -1.0f);
   }
 
-  g_labelId = 0;
+  int numMyLabels = 0;
   // determine if data is float or double
   if (data->IsA("vtkFloatArray")) {
-    extractComponents(vtkFloatArray::SafeDownCast(data)->GetPointer(0),
-  		      cellRes, labels->GetPointer(0));
+    numMyLabels =
+      labelComponents(vtkFloatArray::SafeDownCast(data)->GetPointer(0),
+		      cellRes, g_emf0, 0, labels->GetPointer(0));
   }
   else if (data->IsA("vtkDoubleArray")) {
-    extractComponents(vtkDoubleArray::SafeDownCast(data)->GetPointer(0),
-  		      cellRes, labels->GetPointer(0));
+    numMyLabels =
+      labelComponents(vtkDoubleArray::SafeDownCast(data)->GetPointer(0),
+		      cellRes, g_emf0, 0, labels->GetPointer(0));
   }
 
   //--------------------------------------------------------------------------
@@ -460,7 +380,6 @@ void vtkVofComponents::ExtractComponents(vtkRectilinearGrid *vof,
       recvOffsets[i] = i;
     }
 
-    int numMyLabels = g_labelId;
     std::vector<int> allNumLabels(numProcesses);
     Controller->AllGatherV(&numMyLabels, &allNumLabels[0], 1, &recvLengths[0], &recvOffsets[0]);
     std::vector<int> labelOffsets(numProcesses);
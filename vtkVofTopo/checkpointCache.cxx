@@ -0,0 +1,92 @@
+#include "checkpointCache.h"
+
+CheckpointCache::CheckpointCache() :
+  Budget(0),
+  MemorySize(0),
+  UseCounter(0),
+  NumHits(0),
+  NumMisses(0)
+{
+}
+
+void CheckpointCache::SetBudget(const size_t bytes)
+{
+  Budget = bytes;
+  Evict();
+}
+
+void CheckpointCache::Clear()
+{
+  Checkpoints.clear();
+  MemorySize = 0;
+}
+
+void CheckpointCache::Store(const int timestep,
+			    const ParticleStore &particles,
+			    const int numAdvectionSteps,
+			    const VelocityCache *velocity)
+{
+  std::map<int, Checkpoint>::iterator it = Checkpoints.find(timestep);
+  if (it != Checkpoints.end()) {
+    MemorySize -= it->second.memorySize;
+    Checkpoints.erase(it);
+  }
+
+  Checkpoint &c = Checkpoints[timestep];
+  c.particles.Assign(particles);
+  c.numAdvectionSteps = numAdvectionSteps;
+  c.hasVelocity = velocity != 0;
+  if (velocity != 0) {
+    c.velocity = *velocity;
+  }
+  c.memorySize = c.particles.GetMemorySize() + c.velocity.GetMemorySize();
+  c.lastUse = ++UseCounter;
+  MemorySize += c.memorySize;
+
+  Evict();
+}
+
+int CheckpointCache::FindLatest(const int first, const int last) const
+{
+  std::map<int, Checkpoint>::const_iterator it = Checkpoints.lower_bound(last);
+  if (it == Checkpoints.begin()) {
+    return -1;
+  }
+  --it;
+  return it->first >= first ? it->first : -1;
+}
+
+bool CheckpointCache::Restore(const int timestep, ParticleStore &particles,
+			      int &numAdvectionSteps, VelocityCache &velocity)
+{
+  std::map<int, Checkpoint>::iterator it = Checkpoints.find(timestep);
+  if (it == Checkpoints.end()) {
+    return false;
+  }
+  Checkpoint &c = it->second;
+  particles.Assign(c.particles);
+  numAdvectionSteps = c.numAdvectionSteps;
+  if (c.hasVelocity) {
+    velocity = c.velocity;
+  }
+  else {
+    velocity.Clear();
+  }
+  c.lastUse = ++UseCounter;
+  return true;
+}
+
+void CheckpointCache::Evict()
+{
+  while (MemorySize > Budget && !Checkpoints.empty()) {
+    std::map<int, Checkpoint>::iterator lru = Checkpoints.begin();
+    for (std::map<int, Checkpoint>::iterator it = Checkpoints.begin();
+	 it != Checkpoints.end(); ++it) {
+      if (it->second.lastUse < lru->second.lastUse) {
+	lru = it;
+      }
+    }
+    MemorySize -= lru->second.memorySize;
+    Checkpoints.erase(lru);
+  }
+}
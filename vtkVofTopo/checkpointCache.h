@@ -0,0 +1,69 @@
+#ifndef CHECKPOINTCACHE_H
+#define CHECKPOINTCACHE_H
+
+#include "particleStore.h"
+#include "velocityCache.h"
+#include <map>
+#include <cstddef>
+
+// Snapshots of the advection state of vtkVofTopo at selected time steps.
+//
+// When the target time step moves, the advection resumes from the latest
+// snapshot before the new target instead of starting over at the initial
+// time step. A snapshot holds the particles (alive and dead, so a resumed
+// run gives the same result) and, if needed for temporal interpolation,
+// the velocity at its time step in the storage of the velocity cache. When
+// the snapshots take more than the budget the least recently used ones are
+// dropped.
+class CheckpointCache
+{
+public:
+  CheckpointCache();
+
+  void SetBudget(const size_t bytes);
+  void Clear();
+
+  // stores the state at timestep, replacing an older snapshot of it;
+  // velocity may be 0
+  void Store(const int timestep, const ParticleStore &particles,
+	     const int numAdvectionSteps, const VelocityCache *velocity);
+  // latest time step in [first,last) with a snapshot, -1 if there is none
+  int FindLatest(const int first, const int last) const;
+  // returns false if there is no snapshot of timestep; the velocity is
+  // cleared if the snapshot has none
+  bool Restore(const int timestep, ParticleStore &particles,
+	       int &numAdvectionSteps, VelocityCache &velocity);
+
+  // lookups that could or could not resume from a snapshot
+  void CountHit() { ++NumHits; }
+  void CountMiss() { ++NumMisses; }
+  long long GetNumberOfHits() const { return NumHits; }
+  long long GetNumberOfMisses() const { return NumMisses; }
+
+  size_t GetNumberOfCheckpoints() const { return Checkpoints.size(); }
+  size_t GetMemorySize() const { return MemorySize; }
+
+private:
+
+  struct Checkpoint
+  {
+    ParticleStore particles;
+    int numAdvectionSteps;
+    bool hasVelocity;
+    VelocityCache velocity;
+    size_t memorySize;
+    unsigned long long lastUse;
+  };
+
+  // drops least recently used snapshots until the budget is kept
+  void Evict();
+
+  std::map<int, Checkpoint> Checkpoints;
+  size_t Budget;
+  size_t MemorySize;
+  unsigned long long UseCounter;
+  long long NumHits;
+  long long NumMisses;
+};
+
+#endif//CHECKPOINTCACHE_H
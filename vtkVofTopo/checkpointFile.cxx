@@ -0,0 +1,395 @@
+#include "checkpointFile.h"
+#include "vtkPolyData.h"
+#include "vtkPoints.h"
+#include "vtkPointData.h"
+#include "vtkIntArray.h"
+#include "vtkShortArray.h"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+  const char g_magic[8] = "VOFTOPO";
+  const int g_version = 1;
+  const size_t g_alignment = 64;
+
+  struct FileHeader
+  {
+    char magic[8];
+    int version;
+    int timestep;
+    int numAdvectionSteps;
+    int initTimeStep;
+    int refinement;
+    int hasVelocity;
+    double timeStepDelta;
+    unsigned long long datasetHash;
+    unsigned long long settingsHash;
+    unsigned long long numParticles;
+    unsigned long long numDeadSeeds;
+    unsigned long long numSeeds;
+    int connectivityComponents;
+    int coordsComponents;
+    int velocityPrecision;
+    int velocityCellRes[3];
+    int velocityNodeRes[3];
+    unsigned long long fileSize; // detects truncated files
+  };
+
+  bool matches(const FileHeader &h, const CheckpointKey &key)
+  {
+    return std::memcmp(h.magic, g_magic, sizeof(g_magic)) == 0 &&
+      h.version == g_version &&
+      h.initTimeStep == key.initTimeStep &&
+      h.refinement == key.refinement &&
+      h.timeStepDelta == key.timeStepDelta &&
+      h.datasetHash == key.datasetHash &&
+      h.settingsHash == key.settingsHash;
+  }
+
+  size_t velocityValueSize(const int precision)
+  {
+    return precision == VELOCITY_FLOAT32 ? sizeof(float) : sizeof(float16);
+  }
+
+  // writes every array at an aligned offset
+  class Writer
+  {
+  public:
+    Writer(FILE *f) : Offset(0), Ok(true), File(f) {}
+
+    void Write(const void *data, const size_t bytes)
+    {
+      static const char zeros[g_alignment] = {0};
+      size_t padding = (g_alignment - Offset%g_alignment)%g_alignment;
+      if (padding > 0) {
+	Ok &= std::fwrite(zeros, 1, padding, File) == padding;
+	Offset += padding;
+      }
+      if (bytes > 0) {
+	Ok &= std::fwrite(data, 1, bytes, File) == bytes;
+	Offset += bytes;
+      }
+    }
+
+    size_t Offset;
+    bool Ok;
+
+  private:
+    FILE *File;
+  };
+
+  // walks the arrays of a mapped file in the order they were written
+  class Reader
+  {
+  public:
+    Reader(const char *data, const size_t size) :
+      Data(data), Size(size), Offset(0) {}
+
+    const void *Read(const size_t bytes)
+    {
+      Offset += (g_alignment - Offset%g_alignment)%g_alignment;
+      if (Offset > Size || bytes > Size - Offset) {
+	return 0;
+      }
+      const void *p = Data + Offset;
+      Offset += bytes;
+      return p;
+    }
+
+    template<typename T>
+    bool Read(T *out, const size_t n)
+    {
+      const void *p = Read(n*sizeof(T));
+      if (p == 0) {
+	return false;
+      }
+      if (n > 0) {
+	std::memcpy(out, p, n*sizeof(T));
+      }
+      return true;
+    }
+
+  private:
+    const char *Data;
+    size_t Size;
+    size_t Offset;
+  };
+
+  // maps a file read-only, unmaps it when going out of scope
+  class MappedFile
+  {
+  public:
+    MappedFile(const std::string &fileName) : Data(0), Size(0)
+    {
+      int fd = open(fileName.c_str(), O_RDONLY);
+      if (fd < 0) {
+	return;
+      }
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+	void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED) {
+	  Data = static_cast<const char*>(p);
+	  Size = st.st_size;
+	}
+      }
+      close(fd);
+    }
+    ~MappedFile()
+    {
+      if (Data != 0) {
+	munmap(const_cast<char*>(Data), Size);
+      }
+    }
+
+    const char *Data;
+    size_t Size;
+
+  private:
+    MappedFile(const MappedFile&);
+    void operator=(const MappedFile&);
+  };
+
+  // the header of a mapped file if it is complete and belongs to key
+  const FileHeader *validHeader(const MappedFile &file,
+				const CheckpointKey &key)
+  {
+    if (file.Data == 0 || file.Size < sizeof(FileHeader)) {
+      return 0;
+    }
+    const FileHeader *h = reinterpret_cast<const FileHeader*>(file.Data);
+    if (!matches(*h, key) || h->fileSize != file.Size) {
+      return 0;
+    }
+    return h;
+  }
+}
+
+unsigned long long hashBytes(const void *data, const size_t size,
+			     unsigned long long hash)
+{
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string checkpointFileName(const std::string &directory,
+			       const CheckpointKey &key,
+			       const int processId, const int numProcesses)
+{
+  unsigned long long hash = hashBytes(&key.initTimeStep, sizeof(int));
+  hash = hashBytes(&key.refinement, sizeof(int), hash);
+  hash = hashBytes(&key.timeStepDelta, sizeof(double), hash);
+  hash = hashBytes(&key.datasetHash, sizeof(key.datasetHash), hash);
+  hash = hashBytes(&key.settingsHash, sizeof(key.settingsHash), hash);
+
+  std::ostringstream name;
+  name << directory << "/voftopo_" << std::hex << std::setw(16)
+       << std::setfill('0') << hash << std::dec << "_" << processId
+       << "of" << numProcesses << ".ckpt";
+  return name.str();
+}
+
+bool writeCheckpointFile(const std::string &fileName,
+			 const CheckpointKey &key, const int timestep,
+			 const int numAdvectionSteps,
+			 const ParticleStore &particles,
+			 vtkPolyData *seeds,
+			 const VelocityCache *velocity)
+{
+  vtkPoints *seedPoints = seeds->GetPoints();
+  vtkIntArray *connectivity =
+    vtkIntArray::SafeDownCast(seeds->GetPointData()->GetArray("Connectivity"));
+  vtkShortArray *coords =
+    vtkShortArray::SafeDownCast(seeds->GetPointData()->GetArray("Coords"));
+  const size_t numSeeds = seedPoints != 0 ? seedPoints->GetNumberOfPoints() : 0;
+
+  FileHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, g_magic, sizeof(g_magic));
+  h.version = g_version;
+  h.timestep = timestep;
+  h.numAdvectionSteps = numAdvectionSteps;
+  h.initTimeStep = key.initTimeStep;
+  h.refinement = key.refinement;
+  h.timeStepDelta = key.timeStepDelta;
+  h.datasetHash = key.datasetHash;
+  h.settingsHash = key.settingsHash;
+  h.numParticles = particles.Size();
+  h.numDeadSeeds = particles.GetDeadIds().size();
+  h.numSeeds = numSeeds;
+  h.connectivityComponents = connectivity != 0 ? connectivity->GetNumberOfComponents() : 0;
+  h.coordsComponents = coords != 0 ? coords->GetNumberOfComponents() : 0;
+  h.hasVelocity = velocity != 0 && !velocity->IsEmpty();
+  if (h.hasVelocity) {
+    h.velocityPrecision = velocity->GetPrecision();
+    for (int c = 0; c < 3; ++c) {
+      h.velocityCellRes[c] = velocity->GetCellRes()[c];
+      h.velocityNodeRes[c] = velocity->GetLocator().GetNumberOfNodes(c);
+    }
+  }
+
+  const std::string tmpName = fileName + ".tmp";
+  FILE *f = std::fopen(tmpName.c_str(), "wb");
+  if (f == 0) {
+    return false;
+  }
+
+  const size_t n = particles.Size();
+  Writer w(f);
+  w.Write(&h, sizeof(h));
+  w.Write(particles.GetX(), n*sizeof(float));
+  w.Write(particles.GetY(), n*sizeof(float));
+  w.Write(particles.GetZ(), n*sizeof(float));
+  w.Write(particles.GetVX(), n*sizeof(float));
+  w.Write(particles.GetVY(), n*sizeof(float));
+  w.Write(particles.GetVZ(), n*sizeof(float));
+  w.Write(particles.GetAlive(), n*sizeof(unsigned char));
+  w.Write(particles.GetIds(), n*sizeof(int));
+  w.Write(particles.GetProcs(), n*sizeof(short));
+  w.Write(particles.GetDeadIds().data(), h.numDeadSeeds*sizeof(int));
+  w.Write(particles.GetDeadProcs().data(), h.numDeadSeeds*sizeof(short));
+
+  std::vector<float> points(numSeeds*3);
+  for (size_t i = 0; i < numSeeds; ++i) {
+    double p[3];
+    seedPoints->GetPoint(i, p);
+    points[i*3+0] = p[0];
+    points[i*3+1] = p[1];
+    points[i*3+2] = p[2];
+  }
+  w.Write(points.data(), points.size()*sizeof(float));
+  if (connectivity != 0) {
+    w.Write(connectivity->GetPointer(0),
+	    numSeeds*h.connectivityComponents*sizeof(int));
+  }
+  if (coords != 0) {
+    w.Write(coords->GetPointer(0), numSeeds*h.coordsComponents*sizeof(short));
+  }
+
+  if (h.hasVelocity) {
+    for (int c = 0; c < 3; ++c) {
+      w.Write(velocity->GetLocator().GetCoordinates(c).data(),
+	      h.velocityNodeRes[c]*sizeof(double));
+    }
+    const size_t numValues = size_t(h.velocityCellRes[0])*h.velocityCellRes[1]*
+      h.velocityCellRes[2]*3;
+    w.Write(velocity->GetValues(),
+	    numValues*velocityValueSize(h.velocityPrecision));
+  }
+
+  // the size is known only now
+  h.fileSize = w.Offset;
+  w.Ok &= std::fseek(f, 0, SEEK_SET) == 0;
+  w.Ok &= std::fwrite(&h, sizeof(h), 1, f) == 1;
+  w.Ok &= std::fclose(f) == 0;
+
+  if (!w.Ok || std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    std::remove(tmpName.c_str());
+    return false;
+  }
+  return true;
+}
+
+int readCheckpointTimestep(const std::string &fileName,
+			   const CheckpointKey &key)
+{
+  MappedFile file(fileName);
+  const FileHeader *h = validHeader(file, key);
+  return h != 0 ? h->timestep : -1;
+}
+
+bool readCheckpointFile(const std::string &fileName,
+			const CheckpointKey &key, int &timestep,
+			int &numAdvectionSteps, ParticleStore &particles,
+			vtkPolyData *seeds, VelocityCache &velocity)
+{
+  MappedFile file(fileName);
+  const FileHeader *hp = validHeader(file, key);
+  if (hp == 0) {
+    return false;
+  }
+  const FileHeader h = *hp;
+  const size_t n = h.numParticles;
+  const size_t numSeeds = h.numSeeds;
+
+  Reader r(file.Data, file.Size);
+  r.Read(sizeof(FileHeader));
+
+  particles.Clear();
+  particles.Resize(n);
+  bool ok = true;
+  ok &= r.Read(particles.GetX(), n);
+  ok &= r.Read(particles.GetY(), n);
+  ok &= r.Read(particles.GetZ(), n);
+  ok &= r.Read(particles.GetVX(), n);
+  ok &= r.Read(particles.GetVY(), n);
+  ok &= r.Read(particles.GetVZ(), n);
+  ok &= r.Read(particles.GetAlive(), n);
+  ok &= r.Read(particles.GetIds(), n);
+  ok &= r.Read(particles.GetProcs(), n);
+  std::vector<int> deadIds(h.numDeadSeeds);
+  std::vector<short> deadProcs(h.numDeadSeeds);
+  ok &= r.Read(deadIds.data(), deadIds.size());
+  ok &= r.Read(deadProcs.data(), deadProcs.size());
+  particles.SetDeadSeeds(deadIds, deadProcs);
+
+  std::vector<float> points(numSeeds*3);
+  ok &= r.Read(points.data(), points.size());
+  vtkPoints *seedPoints = vtkPoints::New();
+  seedPoints->SetNumberOfPoints(numSeeds);
+  for (size_t i = 0; i < numSeeds; ++i) {
+    seedPoints->SetPoint(i, &points[i*3]);
+  }
+  seeds->SetPoints(seedPoints);
+  seedPoints->Delete();
+
+  if (h.connectivityComponents > 0) {
+    vtkIntArray *connectivity = vtkIntArray::New();
+    connectivity->SetName("Connectivity");
+    connectivity->SetNumberOfComponents(h.connectivityComponents);
+    connectivity->SetNumberOfTuples(numSeeds);
+    ok &= r.Read(connectivity->GetPointer(0), numSeeds*h.connectivityComponents);
+    seeds->GetPointData()->AddArray(connectivity);
+    connectivity->Delete();
+  }
+  if (h.coordsComponents > 0) {
+    vtkShortArray *coords = vtkShortArray::New();
+    coords->SetName("Coords");
+    coords->SetNumberOfComponents(h.coordsComponents);
+    coords->SetNumberOfTuples(numSeeds);
+    ok &= r.Read(coords->GetPointer(0), numSeeds*h.coordsComponents);
+    seeds->GetPointData()->AddArray(coords);
+    coords->Delete();
+  }
+
+  velocity.Clear();
+  if (h.hasVelocity) {
+    std::vector<double> nodes[3];
+    for (int c = 0; c < 3; ++c) {
+      nodes[c].resize(h.velocityNodeRes[c]);
+      ok &= r.Read(nodes[c].data(), nodes[c].size());
+    }
+    const size_t numValues = size_t(h.velocityCellRes[0])*h.velocityCellRes[1]*
+      h.velocityCellRes[2]*3;
+    const void *values = r.Read(numValues*velocityValueSize(h.velocityPrecision));
+    ok &= values != 0;
+    if (ok) {
+      velocity.SetValues(h.velocityPrecision, h.velocityCellRes, nodes, values);
+    }
+  }
+
+  timestep = h.timestep;
+  numAdvectionSteps = h.numAdvectionSteps;
+  return ok;
+}
@@ -0,0 +1,59 @@
+#ifndef CHECKPOINTFILE_H
+#define CHECKPOINTFILE_H
+
+#include "particleStore.h"
+#include "velocityCache.h"
+#include <string>
+
+class vtkPolyData;
+
+// Identifies the advection a checkpoint file belongs to. A run resumes from
+// a file only if all fields match.
+struct CheckpointKey
+{
+  int initTimeStep;
+  int refinement;
+  double timeStepDelta;
+  unsigned long long datasetHash;  // time values and extents of the input
+  unsigned long long settingsHash; // other properties changing the result
+
+  CheckpointKey() : initTimeStep(0), refinement(0), timeStepDelta(0.0),
+		    datasetHash(0), settingsHash(0) {}
+};
+
+// FNV-1a, for building the hashes of the key
+unsigned long long hashBytes(const void *data, const size_t size,
+			     unsigned long long hash = 14695981039346656037ULL);
+
+// Checkpoint files hold the advection state of one process at one time
+// step: particles with their velocities, ids and processes, the dead seeds,
+// the seed points and, optionally, the velocity field. Every array starts
+// at a 64 byte aligned offset, so the file can be memory-mapped; reading
+// maps the file and copies the arrays out. Files are written to a temporary
+// name and renamed, so an interrupted write leaves the previous checkpoint.
+
+// one file per key and process
+std::string checkpointFileName(const std::string &directory,
+			       const CheckpointKey &key,
+			       const int processId, const int numProcesses);
+
+// velocity may be 0
+bool writeCheckpointFile(const std::string &fileName,
+			 const CheckpointKey &key, const int timestep,
+			 const int numAdvectionSteps,
+			 const ParticleStore &particles,
+			 vtkPolyData *seeds,
+			 const VelocityCache *velocity);
+
+// time step of the checkpoint in the file, -1 if there is no valid file
+// for key
+int readCheckpointTimestep(const std::string &fileName,
+			   const CheckpointKey &key);
+
+// the velocity is cleared if the file has none
+bool readCheckpointFile(const std::string &fileName,
+			const CheckpointKey &key, int &timestep,
+			int &numAdvectionSteps, ParticleStore &particles,
+			vtkPolyData *seeds, VelocityCache &velocity);
+
+#endif//CHECKPOINTFILE_H
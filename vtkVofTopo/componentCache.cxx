@@ -0,0 +1,112 @@
+#include "componentCache.h"
+
+ComponentCache::ComponentCache() :
+  Budget(0),
+  MemorySize(0),
+  UseCounter(0),
+  NumHits(0),
+  NumMisses(0)
+{
+}
+
+void ComponentCache::SetBudget(const size_t bytes)
+{
+  Budget = bytes;
+  Evict();
+}
+
+void ComponentCache::Clear()
+{
+  Entries.clear();
+  MemorySize = 0;
+}
+
+void ComponentCache::Store(const ComponentKey &key, const float *labels,
+			   const size_t numCells)
+{
+  std::map<int, Entry>::iterator it = Entries.find(key.timestep);
+  if (it != Entries.end()) {
+    MemorySize -= it->second.data.size()*sizeof(int);
+    Entries.erase(it);
+  }
+
+  Entry &e = Entries[key.timestep];
+  e.key = key;
+  e.numCells = numCells;
+  e.runLength = true;
+  for (size_t i = 0; i < numCells; ++i) {
+    const int label = labels[i];
+    if (!e.data.empty() && e.data[e.data.size()-2] == label) {
+      ++e.data.back();
+    }
+    else {
+      // runs pay off only while there are fewer than half as many as cells
+      if (e.data.size() >= numCells) {
+	e.runLength = false;
+	break;
+      }
+      e.data.push_back(label);
+      e.data.push_back(1);
+    }
+  }
+  if (!e.runLength) {
+    e.data.resize(numCells);
+    for (size_t i = 0; i < numCells; ++i) {
+      e.data[i] = labels[i];
+    }
+  }
+  e.data.shrink_to_fit();
+  e.lastUse = ++UseCounter;
+  MemorySize += e.data.size()*sizeof(int);
+
+  Evict();
+}
+
+bool ComponentCache::Has(const ComponentKey &key, const size_t numCells) const
+{
+  std::map<int, Entry>::const_iterator it = Entries.find(key.timestep);
+  return it != Entries.end() &&
+    it->second.key.inputMTime == key.inputMTime &&
+    it->second.key.settingsHash == key.settingsHash &&
+    it->second.numCells == numCells;
+}
+
+bool ComponentCache::Restore(const ComponentKey &key, float *labels,
+			     const size_t numCells)
+{
+  if (!Has(key, numCells)) {
+    return false;
+  }
+  Entry &e = Entries[key.timestep];
+  if (e.runLength) {
+    size_t idx = 0;
+    for (size_t r = 0; r < e.data.size(); r += 2) {
+      const float label = e.data[r];
+      for (int i = 0; i < e.data[r+1]; ++i) {
+	labels[idx++] = label;
+      }
+    }
+  }
+  else {
+    for (size_t i = 0; i < numCells; ++i) {
+      labels[i] = e.data[i];
+    }
+  }
+  e.lastUse = ++UseCounter;
+  return true;
+}
+
+void ComponentCache::Evict()
+{
+  while (MemorySize > Budget && !Entries.empty()) {
+    std::map<int, Entry>::iterator lru = Entries.begin();
+    for (std::map<int, Entry>::iterator it = Entries.begin();
+	 it != Entries.end(); ++it) {
+      if (it->second.lastUse < lru->second.lastUse) {
+	lru = it;
+      }
+    }
+    MemorySize -= lru->second.data.size()*sizeof(int);
+    Entries.erase(lru);
+  }
+}
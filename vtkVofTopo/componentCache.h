@@ -0,0 +1,72 @@
+#ifndef COMPONENTCACHE_H
+#define COMPONENTCACHE_H
+
+#include <map>
+#include <vector>
+#include <cstddef>
+
+// Identifies the component labels of one time step. Labels are reused only
+// if all fields match; the refinement, the initial time step and the
+// advection settings do not change the components of a time step, so they
+// are not part of the key.
+struct ComponentKey
+{
+  int timestep;
+  unsigned long long inputMTime;   // of the producer of the volume fractions
+  unsigned long long settingsHash; // extents, processes, ghost levels, ...
+
+  ComponentKey() : timestep(-1), inputMTime(0), settingsHash(0) {}
+};
+
+// Unified component labels (the result of Stage III) of recently labeled
+// time steps. The labels of a cell are integers of at least -1 and are
+// stored as int runs of (label, length), or as one int per cell if the
+// runs would take more space. When the entries take more than the budget
+// the least recently used ones are dropped.
+class ComponentCache
+{
+public:
+  ComponentCache();
+
+  void SetBudget(const size_t bytes);
+  void Clear();
+
+  // replaces the entry of key.timestep
+  void Store(const ComponentKey &key, const float *labels,
+	     const size_t numCells);
+  // returns false if there is no entry for key with numCells cells
+  bool Has(const ComponentKey &key, const size_t numCells) const;
+  bool Restore(const ComponentKey &key, float *labels,
+	       const size_t numCells);
+
+  void CountHit() { ++NumHits; }
+  void CountMiss() { ++NumMisses; }
+  long long GetNumberOfHits() const { return NumHits; }
+  long long GetNumberOfMisses() const { return NumMisses; }
+
+  size_t GetNumberOfEntries() const { return Entries.size(); }
+  size_t GetMemorySize() const { return MemorySize; }
+
+private:
+
+  struct Entry
+  {
+    ComponentKey key;
+    size_t numCells;
+    bool runLength;
+    std::vector<int> data; // (label, length) pairs or one label per cell
+    unsigned long long lastUse;
+  };
+
+  // drops least recently used entries until the budget is kept
+  void Evict();
+
+  std::map<int, Entry> Entries;
+  size_t Budget;
+  size_t MemorySize;
+  unsigned long long UseCounter;
+  long long NumHits;
+  long long NumMisses;
+};
+
+#endif//COMPONENTCACHE_H
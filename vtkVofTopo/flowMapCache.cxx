@@ -0,0 +1,188 @@
+#include "flowMapCache.h"
+#include "vofTopology.h"
+#include "parallelFor.h"
+#include "vtkRectilinearGrid.h"
+#include <cmath>
+#include <limits>
+
+FlowMapCache::FlowMapCache() :
+  UseCounter(0)
+{
+  NodeRes[0] = NodeRes[1] = NodeRes[2] = 0;
+}
+
+void FlowMapCache::Clear()
+{
+  Maps.clear();
+}
+
+bool FlowMapCache::SetLattice(vtkRectilinearGrid *grid, const int refinement)
+{
+  RectilinearLocator gridLocator;
+  buildLocator(grid, gridLocator);
+
+  const int r = 1 << std::max(refinement, 0);
+  std::vector<double> coords[3];
+  for (int c = 0; c < 3; ++c) {
+    const std::vector<double> &nodes = gridLocator.GetCoordinates(c);
+    for (size_t i = 0; i+1 < nodes.size(); ++i) {
+      const double dx = (nodes[i+1] - nodes[i])/r;
+      for (int k = 0; k < r; ++k) {
+	coords[c].push_back(nodes[i] + k*dx);
+      }
+    }
+    if (!nodes.empty()) {
+      coords[c].push_back(nodes.back());
+    }
+  }
+
+  if (coords[0] == Lattice.GetCoordinates(0) &&
+      coords[1] == Lattice.GetCoordinates(1) &&
+      coords[2] == Lattice.GetCoordinates(2)) {
+    return false;
+  }
+
+  for (int c = 0; c < 3; ++c) {
+    NodeRes[c] = coords[c].size();
+    Lattice.SetAxis(c, coords[c].data(), NodeRes[c]);
+  }
+  Cells = gridLocator;
+  Clear();
+  return true;
+}
+
+void FlowMapCache::GetLatticeParticles(ParticleStore &particles) const
+{
+  const std::vector<double> &x = Lattice.GetCoordinates(0);
+  const std::vector<double> &y = Lattice.GetCoordinates(1);
+  const std::vector<double> &z = Lattice.GetCoordinates(2);
+
+  particles.Clear();
+  particles.Resize(size_t(NodeRes[0])*NodeRes[1]*NodeRes[2]);
+  size_t idx = 0;
+  for (int k = 0; k < NodeRes[2]; ++k) {
+    for (int j = 0; j < NodeRes[1]; ++j) {
+      for (int i = 0; i < NodeRes[0]; ++i) {
+	particles.SetPosition(idx, make_float4(x[i], y[j], z[k], 1.0f));
+	particles.SetSeed(idx, idx, 0);
+	++idx;
+      }
+    }
+  }
+}
+
+void FlowMapCache::Store(const int timestep, const ParticleStore &particles,
+			 const OccupancyMask &liquid)
+{
+  FlowMap &map = Maps[timestep];
+  map.positions.resize(particles.Size()*3);
+  for (size_t i = 0; i < particles.Size(); ++i) {
+    float4 p = particles.GetPosition(i);
+    const float x[3] = {p.x, p.y, p.z};
+    int ijk[3];
+    float pcoords[3];
+    if (!particles.IsAlive(i) || !Lattice.FindCell(x, ijk, pcoords)) {
+      p.x = p.y = p.z = std::numeric_limits<float>::quiet_NaN();
+    }
+    map.positions[i*3+0] = p.x;
+    map.positions[i*3+1] = p.y;
+    map.positions[i*3+2] = p.z;
+  }
+  map.liquid = liquid;
+  map.lastUse = ++UseCounter;
+}
+
+bool FlowMapCache::Compose(const int first, const int last,
+			   ParticleStore &particles, const int numThreads)
+{
+  const size_t dx = 1;
+  const size_t dy = NodeRes[0];
+  const size_t dz = size_t(NodeRes[0])*NodeRes[1];
+  const size_t corners[8] = {0, dx, dy, dx+dy, dz, dx+dz, dy+dz, dx+dy+dz};
+
+  for (int t = first; t < last; ++t) {
+
+    std::map<int, FlowMap>::iterator it = Maps.find(t);
+    if (it == Maps.end()) {
+      return false;
+    }
+    it->second.lastUse = ++UseCounter;
+    const float *positions = it->second.positions.data();
+    const OccupancyMask &liquid = it->second.liquid;
+
+    parallelFor(numThreads, particles.Size(), 4096,
+		[&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; ++i) {
+
+	if (!particles.IsAlive(i)) {
+	  continue;
+	}
+	float4 p = particles.GetPosition(i);
+	const float x[3] = {p.x, p.y, p.z};
+	int ijk[3];
+	float pcoords[3];
+	if (!Lattice.FindCell(x, ijk, pcoords)) {
+	  particles.Kill(i);
+	  continue;
+	}
+
+	const size_t base = ijk[0] + dy*ijk[1] + dz*ijk[2];
+	float q[3] = {0.0f, 0.0f, 0.0f};
+	bool lost = false;
+	for (int c = 0; c < 8; ++c) {
+	  const float *node = positions + (base + corners[c])*3;
+	  if (std::isnan(node[0])) {
+	    lost = true;
+	    break;
+	  }
+	  const float w = ((c & 1) ? pcoords[0] : 1.0f-pcoords[0])*
+	    ((c & 2) ? pcoords[1] : 1.0f-pcoords[1])*
+	    ((c & 4) ? pcoords[2] : 1.0f-pcoords[2]);
+	  q[0] += w*node[0];
+	  q[1] += w*node[1];
+	  q[2] += w*node[2];
+	}
+	// the particles of the direct advection die in the empty cells of
+	// the end of every interval
+	if (lost || (Cells.FindCell(q, ijk, pcoords) &&
+		     !liquid.IsLiquid(ijk[0], ijk[1], ijk[2]))) {
+	  particles.Kill(i);
+	  continue;
+	}
+	particles.SetPosition(i, make_float4(q[0], q[1], q[2], 1.0f));
+      }
+    });
+  }
+  return true;
+}
+
+void FlowMapCache::Evict(const size_t budget, const int first, const int last)
+{
+  while (GetMemorySize() > budget) {
+    std::map<int, FlowMap>::iterator lru = Maps.end();
+    for (std::map<int, FlowMap>::iterator it = Maps.begin();
+	 it != Maps.end(); ++it) {
+      if (it->first >= first && it->first < last) {
+	continue;
+      }
+      if (lru == Maps.end() || it->second.lastUse < lru->second.lastUse) {
+	lru = it;
+      }
+    }
+    if (lru == Maps.end()) {
+      return;
+    }
+    Maps.erase(lru);
+  }
+}
+
+size_t FlowMapCache::GetMemorySize() const
+{
+  size_t size = 0;
+  for (std::map<int, FlowMap>::const_iterator it = Maps.begin();
+       it != Maps.end(); ++it) {
+    size += it->second.positions.size()*sizeof(float) +
+      it->second.liquid.GetMemorySize();
+  }
+  return size;
+}
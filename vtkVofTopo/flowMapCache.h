@@ -0,0 +1,74 @@
+#ifndef FLOWMAPCACHE_H
+#define FLOWMAPCACHE_H
+
+#include "helper_math.h"
+#include "rectilinearLocator.h"
+#include "particleStore.h"
+#include "occupancyMask.h"
+#include <map>
+#include <vector>
+#include <cstddef>
+
+class vtkRectilinearGrid;
+
+// Flow maps of single time step intervals, used to move the seeds of any
+// initial time step to the target time step by composing maps instead of
+// integrating the velocity field again.
+//
+// A flow map holds the positions that the nodes of a lattice reach during
+// one interval. The lattice is the node grid of the volume fractions with
+// every cell split 2^refinement times per axis. Other positions are mapped
+// by trilinear interpolation of the positions reached by the nodes of their
+// lattice cell; a particle dies when it is outside the lattice or a node of
+// its cell left the domain. The nodes are advected without dying in empty
+// cells, since a node in the gas still moves the particles of its cells;
+// instead every map keeps the liquid cells at its end, and a particle that
+// ends an interval in an empty cell dies as in the direct advection. Every
+// composed interval adds the interpolation error, so a finer lattice
+// trades memory for accuracy.
+class FlowMapCache
+{
+public:
+  FlowMapCache();
+
+  void Clear();
+  // returns true and clears the maps if the lattice of grid differs from
+  // the current one
+  bool SetLattice(vtkRectilinearGrid *grid, const int refinement);
+  // one particle at every node of the lattice
+  void GetLatticeParticles(ParticleStore &particles) const;
+
+  // stores the lattice particles advected from timestep to timestep+1 and
+  // the liquid cells of the volume fractions at timestep+1
+  void Store(const int timestep, const ParticleStore &particles,
+	     const OccupancyMask &liquid);
+  bool Has(const int timestep) const { return Maps.find(timestep) != Maps.end(); }
+  // maps the alive particles through the intervals from first to last;
+  // returns false if a map is missing
+  bool Compose(const int first, const int last, ParticleStore &particles,
+	       const int numThreads);
+
+  // drops least recently used maps outside of the intervals [first,last)
+  // while the maps take more than budget bytes
+  void Evict(const size_t budget, const int first, const int last);
+
+  size_t GetNumberOfMaps() const { return Maps.size(); }
+  size_t GetMemorySize() const;
+
+private:
+
+  struct FlowMap
+  {
+    std::vector<float> positions; // xyz per node, nan if the node left
+    OccupancyMask liquid;         // at the end of the interval
+    unsigned long long lastUse;
+  };
+
+  RectilinearLocator Lattice;
+  RectilinearLocator Cells; // of the volume fractions
+  int NodeRes[3];
+  std::map<int, FlowMap> Maps;
+  unsigned long long UseCounter;
+};
+
+#endif//FLOWMAPCACHE_H
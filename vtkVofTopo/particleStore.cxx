@@ -0,0 +1,176 @@
+#include "particleStore.h"
+#include <algorithm>
+
+namespace
+{
+  template<typename T>
+  void permute(std::vector<T> &values, const std::vector<size_t> &order,
+	       std::vector<T> &tmp)
+  {
+    tmp.resize(values.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      tmp[i] = values[order[i]];
+    }
+    values.swap(tmp);
+  }
+}
+
+ParticleStore::ParticleStore() :
+  NumParticles(0),
+  NumAllocated(0)
+{
+}
+
+void ParticleStore::Allocate(size_t capacity)
+{
+  X.resize(capacity);
+  Y.resize(capacity);
+  Z.resize(capacity);
+  VX.resize(capacity);
+  VY.resize(capacity);
+  VZ.resize(capacity);
+  Alive.resize(capacity);
+  Ids.resize(capacity);
+  Procs.resize(capacity);
+  NumAllocated = capacity;
+}
+
+void ParticleStore::Clear()
+{
+  NumParticles = 0;
+  DeadIds.clear();
+  DeadProcs.clear();
+}
+
+void ParticleStore::Reserve(size_t capacity)
+{
+  if (capacity > NumAllocated) {
+    Allocate(capacity);
+  }
+}
+
+void ParticleStore::Resize(size_t size)
+{
+  Reserve(size);
+  for (size_t i = NumParticles; i < size; ++i) {
+    X[i] = Y[i] = Z[i] = 0.0f;
+    VX[i] = VY[i] = VZ[i] = 0.0f;
+    Alive[i] = 1;
+    Ids[i] = -1;
+    Procs[i] = 0;
+  }
+  NumParticles = size;
+}
+
+void ParticleStore::ShrinkToFit()
+{
+  if (NumParticles < NumAllocated/4) {
+    Allocate(NumParticles);
+    X.shrink_to_fit();
+    Y.shrink_to_fit();
+    Z.shrink_to_fit();
+    VX.shrink_to_fit();
+    VY.shrink_to_fit();
+    VZ.shrink_to_fit();
+    Alive.shrink_to_fit();
+    Ids.shrink_to_fit();
+    Procs.shrink_to_fit();
+  }
+}
+
+void ParticleStore::Append(const float4 &position, const float4 &velocity,
+			   int id, short proc)
+{
+  if (NumParticles == NumAllocated) {
+    Allocate(NumAllocated > 0 ? 2*NumAllocated : 1024);
+  }
+  const size_t i = NumParticles++;
+  SetPosition(i, position);
+  SetVelocity(i, velocity);
+  SetSeed(i, id, proc);
+}
+
+void ParticleStore::Assign(const ParticleStore &other)
+{
+  const size_t n = other.NumParticles;
+  Reserve(n);
+  std::copy(other.X.begin(), other.X.begin() + n, X.begin());
+  std::copy(other.Y.begin(), other.Y.begin() + n, Y.begin());
+  std::copy(other.Z.begin(), other.Z.begin() + n, Z.begin());
+  std::copy(other.VX.begin(), other.VX.begin() + n, VX.begin());
+  std::copy(other.VY.begin(), other.VY.begin() + n, VY.begin());
+  std::copy(other.VZ.begin(), other.VZ.begin() + n, VZ.begin());
+  std::copy(other.Alive.begin(), other.Alive.begin() + n, Alive.begin());
+  std::copy(other.Ids.begin(), other.Ids.begin() + n, Ids.begin());
+  std::copy(other.Procs.begin(), other.Procs.begin() + n, Procs.begin());
+  NumParticles = n;
+  DeadIds = other.DeadIds;
+  DeadProcs = other.DeadProcs;
+}
+
+size_t ParticleStore::GetMemorySize() const
+{
+  const size_t particleSize = 6*sizeof(float) + sizeof(unsigned char) +
+    sizeof(int) + sizeof(short);
+  return NumAllocated*particleSize +
+    DeadIds.size()*(sizeof(int) + sizeof(short));
+}
+
+void ParticleStore::Move(size_t dst, size_t src)
+{
+  X[dst] = X[src];
+  Y[dst] = Y[src];
+  Z[dst] = Z[src];
+  VX[dst] = VX[src];
+  VY[dst] = VY[src];
+  VZ[dst] = VZ[src];
+  Alive[dst] = Alive[src];
+  Ids[dst] = Ids[src];
+  Procs[dst] = Procs[src];
+}
+
+void ParticleStore::Permute(const std::vector<size_t> &order)
+{
+  std::vector<float> tmpf;
+  permute(X, order, tmpf);
+  permute(Y, order, tmpf);
+  permute(Z, order, tmpf);
+  permute(VX, order, tmpf);
+  permute(VY, order, tmpf);
+  permute(VZ, order, tmpf);
+  std::vector<unsigned char> tmpc;
+  permute(Alive, order, tmpc);
+  std::vector<int> tmpi;
+  permute(Ids, order, tmpi);
+  std::vector<short> tmps;
+  permute(Procs, order, tmps);
+}
+
+size_t ParticleStore::Compact()
+{
+  size_t numKept = 0;
+  for (size_t i = 0; i < NumParticles; ++i) {
+    if (Alive[i]) {
+      if (numKept != i) {
+	Move(numKept, i);
+      }
+      ++numKept;
+    }
+    else {
+      DeadIds.push_back(Ids[i]);
+      DeadProcs.push_back(Procs[i]);
+    }
+  }
+  size_t numRemoved = NumParticles - numKept;
+  NumParticles = numKept;
+  return numRemoved;
+}
+
+size_t ParticleStore::GetNumberOfAlive() const
+{
+  size_t numAlive = 0;
+  for (size_t i = 0; i < NumParticles; ++i) {
+    numAlive += Alive[i] != 0;
+  }
+  return numAlive;
+}
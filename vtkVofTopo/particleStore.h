@@ -0,0 +1,133 @@
+#ifndef PARTICLESTORE_H
+#define PARTICLESTORE_H
+
+#include "helper_math.h"
+#include <vector>
+#include <cstddef>
+
+// Particles advected by vtkVofTopo, stored as structure of arrays.
+//
+// Every particle has a position, a velocity, an alive flag and the id and
+// process of the seed it started from. Dead particles (the ones that left
+// the fluid) are removed by Compact(), which remembers their seeds so that
+// they can still be labeled in TransferLabelsToSeeds.
+class ParticleStore
+{
+public:
+  ParticleStore();
+
+  size_t Size() const { return NumParticles; }
+  size_t Capacity() const { return NumAllocated; }
+
+  // removes all particles and dead seeds, keeps the allocated memory
+  void Clear();
+  // grows the arrays to hold at least capacity particles
+  void Reserve(size_t capacity);
+  // new particles are alive, at the origin, with zero velocity
+  void Resize(size_t size);
+  // releases memory if less than a quarter of the capacity is in use
+  void ShrinkToFit();
+
+  void Append(const float4 &position, const float4 &velocity,
+	      int id, short proc);
+  // copies the particles and dead seeds of other; allocates only as much
+  // memory as needed if the store is smaller
+  void Assign(const ParticleStore &other);
+  // bytes used by the particles and dead seeds
+  size_t GetMemorySize() const;
+
+  // w is 1 for alive and 0 for dead particles
+  float4 GetPosition(size_t i) const
+  {
+    return make_float4(X[i], Y[i], Z[i], Alive[i] ? 1.0f : 0.0f);
+  }
+  void SetPosition(size_t i, const float4 &p)
+  {
+    X[i] = p.x;
+    Y[i] = p.y;
+    Z[i] = p.z;
+    Alive[i] = p.w != 0.0f;
+  }
+  float4 GetVelocity(size_t i) const
+  {
+    return make_float4(VX[i], VY[i], VZ[i], 0.0f);
+  }
+  void SetVelocity(size_t i, const float4 &v)
+  {
+    VX[i] = v.x;
+    VY[i] = v.y;
+    VZ[i] = v.z;
+  }
+  bool IsAlive(size_t i) const { return Alive[i] != 0; }
+  void Kill(size_t i) { Alive[i] = 0; }
+  int GetId(size_t i) const { return Ids[i]; }
+  short GetProc(size_t i) const { return Procs[i]; }
+  void SetSeed(size_t i, int id, short proc)
+  {
+    Ids[i] = id;
+    Procs[i] = proc;
+  }
+
+  // raw arrays for the kernels
+  float *GetX() { return X.data(); }
+  float *GetY() { return Y.data(); }
+  float *GetZ() { return Z.data(); }
+  float *GetVX() { return VX.data(); }
+  float *GetVY() { return VY.data(); }
+  float *GetVZ() { return VZ.data(); }
+  unsigned char *GetAlive() { return Alive.data(); }
+  int *GetIds() { return Ids.data(); }
+  short *GetProcs() { return Procs.data(); }
+  const float *GetX() const { return X.data(); }
+  const float *GetY() const { return Y.data(); }
+  const float *GetZ() const { return Z.data(); }
+  const float *GetVX() const { return VX.data(); }
+  const float *GetVY() const { return VY.data(); }
+  const float *GetVZ() const { return VZ.data(); }
+  const unsigned char *GetAlive() const { return Alive.data(); }
+  const int *GetIds() const { return Ids.data(); }
+  const short *GetProcs() const { return Procs.data(); }
+
+  // copies particle src to dst, src is left unchanged
+  void Move(size_t dst, size_t src);
+  // reorders the particles so that particle order[i] becomes particle i;
+  // order must be a permutation of [0,Size())
+  void Permute(const std::vector<size_t> &order);
+
+  // removes dead particles, keeps the order of the alive ones; returns the
+  // number of removed particles
+  size_t Compact();
+  size_t GetNumberOfAlive() const;
+
+  // seeds whose particles died and were removed by Compact()
+  const std::vector<int> &GetDeadIds() const { return DeadIds; }
+  const std::vector<short> &GetDeadProcs() const { return DeadProcs; }
+  void SetDeadSeeds(const std::vector<int> &ids,
+		    const std::vector<short> &procs)
+  {
+    DeadIds = ids;
+    DeadProcs = procs;
+  }
+
+private:
+
+  void Allocate(size_t capacity);
+
+  size_t NumParticles;
+  size_t NumAllocated;
+
+  std::vector<float> X;
+  std::vector<float> Y;
+  std::vector<float> Z;
+  std::vector<float> VX;
+  std::vector<float> VY;
+  std::vector<float> VZ;
+  std::vector<unsigned char> Alive;
+  std::vector<int> Ids;
+  std::vector<short> Procs;
+
+  std::vector<int> DeadIds;
+  std::vector<short> DeadProcs;
+};
+
+#endif//PARTICLESTORE_H
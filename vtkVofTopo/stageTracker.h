@@ -0,0 +1,60 @@
+#ifndef STAGETRACKER_H
+#define STAGETRACKER_H
+
+#include <string>
+
+// Signatures of the parameters and inputs the stages of vtkVofTopo
+// depended on when they last ran. A stage whose signature is unchanged
+// keeps its result; the signature of a stage includes the one of the stage
+// it depends on, so a changed stage also runs all later ones.
+class StageTracker
+{
+public:
+  enum Stage {
+    ADVECTION,  // I-II, particles at the target time step
+    LABELS,     // III-V, labels of the particles and seeds
+    BOUNDARIES, // VI, boundaries and output particles
+    NUM_STAGES
+  };
+
+  StageTracker() { Clear(); }
+
+  void Clear()
+  {
+    for (int i = 0; i < NUM_STAGES; ++i) {
+      Valid[i] = false;
+      Signatures[i] = 0;
+    }
+  }
+
+  bool IsCurrent(const Stage stage, const unsigned long long signature) const
+  {
+    return Valid[stage] && Signatures[stage] == signature;
+  }
+
+  // a stage that ran invalidates the results of the later ones
+  void Record(const Stage stage, const unsigned long long signature)
+  {
+    Valid[stage] = true;
+    Signatures[stage] = signature;
+    for (int i = stage+1; i < NUM_STAGES; ++i) {
+      Valid[i] = false;
+    }
+  }
+
+  // for the log of the filter
+  static std::string Describe(const Stage stage, const bool run)
+  {
+    static const char *names[NUM_STAGES] = {"I-II (advection)",
+					    "III-V (labels)",
+					    "VI (boundaries)"};
+    return std::string("Stages ") + names[stage] + ": " +
+      (run ? "run" : "skipped, dependencies unchanged");
+  }
+
+private:
+  bool Valid[NUM_STAGES];
+  unsigned long long Signatures[NUM_STAGES];
+};
+
+#endif//STAGETRACKER_H
@@ -0,0 +1,180 @@
+#include "velocityCache.h"
+#include "vofTopology.h"
+#include "vtkRectilinearGrid.h"
+#include "vtkCellData.h"
+#include "vtkDataArray.h"
+#include "vtkFloatArray.h"
+#include "vtkDoubleArray.h"
+#include "parallelFor.h"
+#include <iostream>
+
+namespace
+{
+  template<typename S, typename T>
+  void convert(const S *src, const size_t n, T *dst, const int numThreads)
+  {
+    parallelFor(numThreads, n, 1 << 16,
+		[&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; ++i) {
+	dst[i] = T::fromFloat(src[i]);
+      }
+    });
+  }
+
+  template<typename S>
+  void convert(const S *src, const size_t n, float *dst, const int numThreads)
+  {
+    parallelFor(numThreads, n, 1 << 16,
+		[&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; ++i) {
+	dst[i] = src[i];
+      }
+    });
+  }
+
+  // converts the velocity array to T, without an intermediate copy for
+  // float and double arrays
+  template<typename T>
+  void convertArray(vtkDataArray *array, std::vector<T> &values,
+		    const int numThreads)
+  {
+    values.resize(array->GetNumberOfTuples()*3);
+    if (array->IsA("vtkFloatArray")) {
+      convert(vtkFloatArray::SafeDownCast(array)->GetPointer(0),
+	      values.size(), values.data(), numThreads);
+    }
+    else if (array->IsA("vtkDoubleArray")) {
+      convert(vtkDoubleArray::SafeDownCast(array)->GetPointer(0),
+	      values.size(), values.data(), numThreads);
+    }
+    else {
+      std::vector<float> tmp(values.size());
+      for (size_t i = 0; i < tmp.size(); ++i) {
+	tmp[i] = array->GetComponent(i/3, i%3);
+      }
+      convert(tmp.data(), tmp.size(), values.data(), numThreads);
+    }
+  }
+
+  template<typename T>
+  void release(std::vector<T> &values)
+  {
+    std::vector<T>().swap(values);
+  }
+}
+
+VelocityCache::VelocityCache() :
+  Precision(VELOCITY_FLOAT32),
+  NumCells(0)
+{
+  CellRes[0] = CellRes[1] = CellRes[2] = 0;
+}
+
+bool VelocityCache::Set(vtkRectilinearGrid *grid, const int precision,
+			const int numThreads)
+{
+  int index;
+  vtkDataArray *velocity = grid->GetCellData()->GetArray("Data", index);
+  if (index == -1 || velocity->GetNumberOfComponents() != 3) {
+    std::cout << __LINE__ << ": Array not found!" << std::endl;
+    Clear();
+    return false;
+  }
+
+  int nodeRes[3];
+  grid->GetDimensions(nodeRes);
+  for (int c = 0; c < 3; ++c) {
+    CellRes[c] = nodeRes[c]-1;
+  }
+  NumCells = velocity->GetNumberOfTuples();
+  buildLocator(grid, Locator);
+
+  Precision = precision;
+  if (Precision == VELOCITY_FLOAT16) {
+    convertArray(velocity, Half, numThreads);
+    release(Single);
+    release(BFloat);
+  }
+  else if (Precision == VELOCITY_BFLOAT16) {
+    convertArray(velocity, BFloat, numThreads);
+    release(Single);
+    release(Half);
+  }
+  else {
+    Precision = VELOCITY_FLOAT32;
+    convertArray(velocity, Single, numThreads);
+    release(Half);
+    release(BFloat);
+  }
+  return true;
+}
+
+void VelocityCache::Clear()
+{
+  NumCells = 0;
+  CellRes[0] = CellRes[1] = CellRes[2] = 0;
+  Locator = RectilinearLocator();
+  release(Single);
+  release(Half);
+  release(BFloat);
+}
+
+void VelocityCache::Swap(VelocityCache &other)
+{
+  std::swap(Precision, other.Precision);
+  for (int c = 0; c < 3; ++c) {
+    std::swap(CellRes[c], other.CellRes[c]);
+  }
+  std::swap(NumCells, other.NumCells);
+  std::swap(Locator, other.Locator);
+  Single.swap(other.Single);
+  Half.swap(other.Half);
+  BFloat.swap(other.BFloat);
+}
+
+size_t VelocityCache::GetMemorySize() const
+{
+  return Single.size()*sizeof(float) + Half.size()*sizeof(float16) +
+    BFloat.size()*sizeof(bfloat16);
+}
+
+const void *VelocityCache::GetValues() const
+{
+  if (Precision == VELOCITY_FLOAT16) {
+    return Half.data();
+  }
+  if (Precision == VELOCITY_BFLOAT16) {
+    return BFloat.data();
+  }
+  return Single.data();
+}
+
+void VelocityCache::SetValues(const int precision, const int cellRes[3],
+			      const std::vector<double> coords[3],
+			      const void *values)
+{
+  Clear();
+  Precision = precision;
+  int nodeRes[3];
+  for (int c = 0; c < 3; ++c) {
+    CellRes[c] = cellRes[c];
+    nodeRes[c] = coords[c].size();
+  }
+  NumCells = size_t(cellRes[0])*cellRes[1]*cellRes[2];
+  Locator.SetCoordinates(coords[0].data(), coords[1].data(), coords[2].data(),
+			 nodeRes);
+
+  const size_t n = NumCells*3;
+  if (Precision == VELOCITY_FLOAT16) {
+    const float16 *v = static_cast<const float16*>(values);
+    Half.assign(v, v + n);
+  }
+  else if (Precision == VELOCITY_BFLOAT16) {
+    const bfloat16 *v = static_cast<const bfloat16*>(values);
+    BFloat.assign(v, v + n);
+  }
+  else {
+    const float *v = static_cast<const float*>(values);
+    Single.assign(v, v + n);
+  }
+}
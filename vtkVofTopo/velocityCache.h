@@ -0,0 +1,106 @@
+#ifndef VELOCITYCACHE_H
+#define VELOCITYCACHE_H
+
+#include "helper_math.h"
+#include "rectilinearLocator.h"
+#include "trilinear.h"
+#include "float16.h"
+#include <vector>
+#include <cstddef>
+
+class vtkRectilinearGrid;
+
+// storage of the velocities in VelocityCache
+enum {
+  VELOCITY_FLOAT32 = 0,
+  VELOCITY_FLOAT16 = 1,
+  VELOCITY_BFLOAT16 = 2
+};
+
+// Cell velocities of one loaded time step, as used by the advection stage.
+//
+// The "Data" array of the velocity grid is converted once to packed xyz
+// values with float32, float16 or bfloat16 storage, and the cell locator of
+// the grid is built along with it, so the grid itself does not have to be
+// kept. Interpolation always computes in float32; the 16-bit formats halve
+// the memory read per sample at the cost of a relative error of 2^-11
+// (float16) or 2^-8 (bfloat16).
+class VelocityCache
+{
+public:
+  VelocityCache();
+
+  // returns false if the grid has no velocity array "Data"
+  bool Set(vtkRectilinearGrid *grid, const int precision,
+	   const int numThreads);
+  void Clear();
+  void Swap(VelocityCache &other);
+
+  bool IsEmpty() const { return NumCells == 0; }
+  int GetPrecision() const { return Precision; }
+  const int *GetCellRes() const { return CellRes; }
+  const RectilinearLocator &GetLocator() const { return Locator; }
+  // bytes used by the velocities
+  size_t GetMemorySize() const;
+
+  // raw values in the storage of the precision, for checkpoint files
+  const void *GetValues() const;
+  // sets the cache from raw values in the storage of precision and the
+  // node coordinates of the grid
+  void SetValues(const int precision, const int cellRes[3],
+		 const std::vector<double> coords[3], const void *values);
+
+  // cell-centered interpolation of a batch of particles
+  void Interpolate(const size_t n, const int *const cell[3],
+		   const float *const pcoords[3], float *const out[3]) const
+  {
+    if (Precision == VELOCITY_FLOAT16) {
+      trilinearBatch<TRILINEAR_CELLS, 3>(Half.data(), CellRes, n, cell, pcoords, out);
+    }
+    else if (Precision == VELOCITY_BFLOAT16) {
+      trilinearBatch<TRILINEAR_CELLS, 3>(BFloat.data(), CellRes, n, cell, pcoords, out);
+    }
+    else {
+      trilinearBatch<TRILINEAR_CELLS, 3>(Single.data(), CellRes, n, cell, pcoords, out);
+    }
+  }
+
+  float4 Interpolate(const int cell[3], const float pcoords[3]) const
+  {
+    float v[3];
+    if (Precision == VELOCITY_FLOAT16) {
+      trilinear<TRILINEAR_CELLS, 3>(Half.data(), CellRes, cell, pcoords, v);
+    }
+    else if (Precision == VELOCITY_BFLOAT16) {
+      trilinear<TRILINEAR_CELLS, 3>(BFloat.data(), CellRes, cell, pcoords, v);
+    }
+    else {
+      trilinear<TRILINEAR_CELLS, 3>(Single.data(), CellRes, cell, pcoords, v);
+    }
+    return make_float4(v[0], v[1], v[2], 0.0f);
+  }
+
+  // locates x and interpolates the velocity there
+  float4 Sample(const float4 &x) const
+  {
+    float p[3] = {x.x, x.y, x.z};
+    int ijk[3];
+    float pcoords[3];
+    Locator.FindCell(p, ijk, pcoords);
+    return Interpolate(ijk, pcoords);
+  }
+
+private:
+
+  int Precision;
+  int CellRes[3];
+  size_t NumCells;
+  RectilinearLocator Locator;
+
+  // only the array of the current precision is used
+  std::vector<float> Single;
+  std::vector<float16> Half;
+  std::vector<bfloat16> BFloat;
+};
+
+#endif//VELOCITYCACHE_H
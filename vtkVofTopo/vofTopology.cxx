@@ -1,4 +1,5 @@
 #include "vofTopology.h"
+#include "vtkMPICommunicator.h"
 #include "vtkDataArray.h"
 #include "vtkPointData.h"
 #include "vtkCellData.h"
@@ -6,6 +7,7 @@
 #include "vtkDoubleArray.h"
 #include "vtkIdTypeArray.h"
 #include "vtkShortArray.h"
+#include "vtkSignedCharArray.h"
 #include "vtkCellArray.h"
 #include <iostream>
 #include <map>
@@ -16,6 +18,8 @@
 #include <array>
 
 #include "marchingCubes_cpu.h"
+#include "parallelFor.h"
+#include "trilinear.h"
 
 namespace
 {
@@ -92,12 +96,10 @@ namespace
 		      const float cellSize[3],
 		      const int refinement,
 		      const int cellRes[3],
-		      const float f,
-		      const std::vector<float> &lstar,
-		      const std::vector<float> &normalsInt,
+		      const bool full,
+		      const float plane[4],
 		      const double bounds[6],
 		      const int cell_x, const int cell_y, const int cell_z,
-		      const int idx,
 		      std::map<int3, int, bool(*)(const int3 &a, const int3 &b)> &seedPos,
 		      int &seedIdx)
   {
@@ -124,12 +126,12 @@ namespace
     }
 
     float attachPoint[3] =
-      {normalsInt[idx*3+0]>0 ? cellCenter[0]-cellSize[0]/2.0f : cellCenter[0]+cellSize[0]/2.0f,
-       normalsInt[idx*3+1]>0 ? cellCenter[1]-cellSize[1]/2.0f : cellCenter[1]+cellSize[1]/2.0f,
-       normalsInt[idx*3+2]>0 ? cellCenter[2]-cellSize[2]/2.0f : cellCenter[2]+cellSize[2]/2.0f};
-    float n[3] = {normalsInt[idx*3+0],
-		  normalsInt[idx*3+1],
-		  normalsInt[idx*3+2]};
+      {plane[0]>0 ? cellCenter[0]-cellSize[0]/2.0f : cellCenter[0]+cellSize[0]/2.0f,
+       plane[1]>0 ? cellCenter[1]-cellSize[1]/2.0f : cellCenter[1]+cellSize[1]/2.0f,
+       plane[2]>0 ? cellCenter[2]-cellSize[2]/2.0f : cellCenter[2]+cellSize[2]/2.0f};
+    float n[3] = {plane[0],
+		  plane[1],
+		  plane[2]};
 
     for (int zr = 0; zr < subdiv; ++zr) {
       for (int yr = 0; yr < subdiv; ++yr) {
@@ -149,7 +151,7 @@ namespace
 	  d = std::abs(d);
 
 	  if (pointWithinBounds(seed, bounds) &&
-	      (f < g_emf1 && d < lstar[idx] || f >= g_emf1)) {	    
+	      (!full && d < plane[3] || full)) {	    
 
 	    seeds->InsertNextPoint(seed);
 	    int3 pos = {cell_x*subdiv + xr, 
@@ -163,9 +165,29 @@ namespace
     }    
   }
 
-  void computeGradient(vtkRectilinearGrid *grid, vtkDataArray *data,
+  // values of a scalar field in the kernels below; compressed volume
+  // fractions (see compressVof) are scaled back to [0,1]
+  inline float fieldValue(const float *f, const ptrdiff_t i)
+  {
+    return f[i];
+  }
+  inline double fieldValue(const double *f, const ptrdiff_t i)
+  {
+    return f[i];
+  }
+  inline float fieldValue(const signed char *f, const ptrdiff_t i)
+  {
+    return f[i]/127.0f;
+  }
+  inline float fieldValue(const BrickedVolume *f, const ptrdiff_t i)
+  {
+    return f->Value(i);
+  }
+
+  template<typename T>
+  void computeGradient(vtkRectilinearGrid *grid, const T *data,
 		       const int res[3], int ijk[3],
-		       vtkDataArray *coordCenters[3],
+		       const std::vector<float> coordCenters[3],
 		       double pcoords[3], float grad[3])
   {
     int i = ijk[0];
@@ -173,13 +195,13 @@ namespace
     int k = ijk[2];
     int im = std::max(i-1,0);
     int ip = std::min(i+1,res[0]-1);
-    float dx = coordCenters[0]->GetComponent(ip,0) - coordCenters[0]->GetComponent(im,0);
+    float dx = coordCenters[0][ip] - coordCenters[0][im];
     int jm = std::max(j-1,0);	  
     int jp = std::min(j+1,res[1]-1);
-    float dy = coordCenters[1]->GetComponent(jp,0) - coordCenters[1]->GetComponent(jm,0);
+    float dy = coordCenters[1][jp] - coordCenters[1][jm];
     int km = std::max(k-1,0);	  
     int kp = std::min(k+1,res[2]-1);
-    float dz = coordCenters[2]->GetComponent(kp,0) - coordCenters[2]->GetComponent(km,0);
+    float dz = coordCenters[2][kp] - coordCenters[2][km];
 
     int id_left   = im + j*res[0] + k*res[0]*res[1];
     int id_right  = ip + j*res[0] + k*res[0]*res[1];
@@ -195,27 +217,28 @@ namespace
     // int f_back;
     // int f_front;
     
-    grad[0] = (data->GetComponent(id_right,0) - 
-	       data->GetComponent(id_left,0))/dx;
-    grad[1] = (data->GetComponent(id_top,0) - 
-	       data->GetComponent(id_bottom,0))/dy;
-    grad[2] = (data->GetComponent(id_front,0) - 
-	       data->GetComponent(id_back,0))/dz;
+    grad[0] = (fieldValue(data, id_right) - 
+	       fieldValue(data, id_left))/dx;
+    grad[1] = (fieldValue(data, id_top) - 
+	       fieldValue(data, id_bottom))/dy;
+    grad[2] = (fieldValue(data, id_front) - 
+	       fieldValue(data, id_back))/dz;
   }
 
-  void computeGradient(vtkDataArray *data, const int res[3], 
+  template<typename T>
+  void computeGradient(const T *data, const int res[3], 
 		       int i, int j, int k, 
-		       vtkDataArray *coordCenters[3], float grad[3])
+		       const std::vector<float> coordCenters[3], float grad[3])
   {
     int im = std::max(i-1,0);
     int ip = std::min(i+1,res[0]-1);
-    float dx = coordCenters[0]->GetComponent(ip,0) - coordCenters[0]->GetComponent(im,0);
+    float dx = coordCenters[0][ip] - coordCenters[0][im];
     int jm = std::max(j-1,0);	  
     int jp = std::min(j+1,res[1]-1);
-    float dy = coordCenters[1]->GetComponent(jp,0) - coordCenters[1]->GetComponent(jm,0);
+    float dy = coordCenters[1][jp] - coordCenters[1][jm];
     int km = std::max(k-1,0);	  
     int kp = std::min(k+1,res[2]-1);
-    float dz = coordCenters[2]->GetComponent(kp,0) - coordCenters[2]->GetComponent(km,0);
+    float dz = coordCenters[2][kp] - coordCenters[2][km];
 
     int id_left = im + j*res[0] + k*res[0]*res[1];
     int id_right = ip + j*res[0] + k*res[0]*res[1];
@@ -224,99 +247,421 @@ namespace
     int id_back = i + j*res[0] + km*res[0]*res[1];
     int id_front = i + j*res[0] + kp*res[0]*res[1];
 
-    grad[0] = (data->GetComponent(id_right,0) - 
-	       data->GetComponent(id_left,0))/dx;
-    grad[1] = (data->GetComponent(id_top,0) - 
-	       data->GetComponent(id_bottom,0))/dy;
-    grad[2] = (data->GetComponent(id_front,0) - 
-	       data->GetComponent(id_back,0))/dz;
+    grad[0] = (fieldValue(data, id_right) - 
+	       fieldValue(data, id_left))/dx;
+    grad[1] = (fieldValue(data, id_top) - 
+	       fieldValue(data, id_bottom))/dy;
+    grad[2] = (fieldValue(data, id_front) - 
+	       fieldValue(data, id_back))/dz;
   }
 
-  static float3 interpolateVec(vtkDataArray *velocityField,
-			       const int* res, const int idxCell[3],
-			       const double bcoords[3])
+  // node coordinates and cell centers of one axis of a rectilinear grid
+  void getAxisCoordinates(vtkDataArray *coordNodes,
+			  std::vector<double> &nodes,
+			  std::vector<float> &centers)
   {
-    int lx = idxCell[0];
-    int ly = idxCell[1];
-    int lz = idxCell[2];
-    float x = bcoords[0] - 0.5;
-    float y = bcoords[1] - 0.5;
-    float z = bcoords[2] - 0.5;
-
-    if (bcoords[0] < 0.5) {
-      lx -= 1;
-      x = bcoords[0] + 0.5;
+    const int numNodes = coordNodes->GetNumberOfTuples();
+    nodes.resize(numNodes);
+    centers.resize(std::max(numNodes-1, 0));
+    for (int i = 0; i < numNodes; ++i) {
+      nodes[i] = coordNodes->GetComponent(i,0);
     }
-    if (bcoords[1] < 0.5) {
-      ly -= 1;
-      y = bcoords[1] + 0.5;
+    for (int i = 0; i+1 < numNodes; ++i) {
+      centers[i] = (nodes[i] + nodes[i+1])/2.0f;
     }
-    if (bcoords[2] < 0.5) {
-      lz -= 1;
-      z = bcoords[2] + 0.5;
+  }
+
+  // raw values of a float, double or compressed volume fraction array, or
+  // of a bricked volume without the array, for the typed kernels; arrays of
+  // other types are converted to float once. Exactly one of f, d, q and b
+  // is set
+  struct FieldView
+  {
+    const float *f;
+    const double *d;
+    const signed char *q;
+    const BrickedVolume *b;
+    std::vector<float> converted;
+
+    FieldView() : f(0), d(0), q(0), b(0) {}
+
+    void Set(vtkDataArray *array, const BrickedVolume *bricks)
+    {
+      f = 0;
+      d = 0;
+      q = 0;
+      b = 0;
+      converted.clear();
+      if (array == 0) {
+	if (bricks != 0 && !bricks->IsEmpty()) {
+	  b = bricks;
+	}
+	return;
+      }
+      if (array->IsA("vtkFloatArray")) {
+	f = vtkFloatArray::SafeDownCast(array)->GetPointer(0);
+      }
+      else if (array->IsA("vtkDoubleArray")) {
+	d = vtkDoubleArray::SafeDownCast(array)->GetPointer(0);
+      }
+      else if (array->IsA("vtkSignedCharArray") &&
+	       array->GetNumberOfComponents() == 1) {
+	q = vtkSignedCharArray::SafeDownCast(array)->GetPointer(0);
+      }
+      else {
+	const int numComp = array->GetNumberOfComponents();
+	converted.resize(array->GetNumberOfTuples()*numComp);
+	for (size_t i = 0; i < converted.size(); ++i) {
+	  converted[i] = array->GetComponent(i/numComp, i%numComp);
+	}
+	f = converted.data();
+      }
     }
-    
-    int ux = lx+1;
-    int uy = ly+1;
-    int uz = lz+1;
-
-    if (lx < 0) lx = 0;
-    if (ly < 0) ly = 0;
-    if (lz < 0) lz = 0;
-    if (ux > res[0]-1) ux = res[0]-1;
-    if (uy > res[1]-1) uy = res[1]-1;
-    if (uz > res[2]-1) uz = res[2]-1;
-
-    unsigned lzslab = lz*res[0]*res[1];
-    unsigned uzslab = uz*res[0]*res[1];
-    int lyr = ly*res[0];
-    int uyr = uy*res[0];
-
-    unsigned id[8] = {lx + lyr + lzslab,
-		      ux + lyr + lzslab,
-		      lx + uyr + lzslab,
-		      ux + uyr + lzslab,
-		      lx + lyr + uzslab,
-		      ux + lyr + uzslab,
-		      lx + uyr + uzslab,
-		      ux + uyr + uzslab};
-    float3 vv[8];
-    for (int i = 0; i < 8; i++) {
-      vv[i].x = velocityField->GetComponent(id[i], 0);
-      vv[i].y = velocityField->GetComponent(id[i], 1);
-      vv[i].z = velocityField->GetComponent(id[i], 2);
+
+    void Gather(const int res[3], const size_t n,
+		const int *const cell[3], float *out) const
+    {
+      if (d) {
+	gatherCellBatch(d, res, n, cell, out);
+      }
+      else if (b) {
+	for (size_t i = 0; i < n; ++i) {
+	  out[i] = b->Value(cell[0][i], cell[1][i], cell[2][i]);
+	}
+      }
+      else if (q) {
+	gatherCellBatch(q, res, n, cell, out);
+	for (size_t i = 0; i < n; ++i) {
+	  out[i] /= 127.0f;
+	}
+      }
+      else {
+	gatherCellBatch(f, res, n, cell, out);
+      }
+    }
+
+  private:
+    // f may point to converted
+    FieldView(const FieldView&);
+    void operator=(const FieldView&);
+  };
+
+  // particles of one batch of the interpolation kernels, with their cells
+  // and parametric coordinates; cells, pcoords and out point to the arrays
+  // in the kernel layout
+  struct ParticleBatch
+  {
+    static const int Size = 256;
+
+    size_t n;
+    size_t index[Size];
+    int cell[3][Size];
+    float pcoord[3][Size];
+    bool inside[Size];
+    float result[3][Size];
+
+    const int *cells[3];
+    const float *pcoords[3];
+    float *out[3];
+
+    ParticleBatch() : n(0)
+    {
+      for (int c = 0; c < 3; ++c) {
+	cells[c] = cell[c];
+	pcoords[c] = pcoord[c];
+	out[c] = result[c];
+      }
+    }
+
+    // locates the particle at x and appends it to the batch
+    void Add(const RectilinearLocator &locator, const size_t idx,
+	     const float x[3])
+    {
+      int ijk[3];
+      float pc[3];
+      inside[n] = locator.FindCell(x, ijk, pc);
+      for (int c = 0; c < 3; ++c) {
+	cell[c][n] = ijk[c];
+	pcoord[c][n] = pc[c];
+      }
+      index[n] = idx;
+      ++n;
+    }
+
+  private:
+    ParticleBatch(const ParticleBatch&);
+    void operator=(const ParticleBatch&);
+  };
+
+  // samples the velocity field at a particle position; with blend set the
+  // field is interpolated linearly in time between velocity[0] (s = 0) and
+  // velocity[1] (s = 1), otherwise velocity[1] is used for the whole time
+  // step. Every interpolation is counted so that the work done by the
+  // integrators can be reported
+  struct VelocitySampler
+  {
+    const VelocityCache *velocity[2];
+    bool blend;
+
+    float4 sampleField(const int n, const float4 &pos, AdvectionStats &stats) const
+    {
+      ++stats.numVelocitySamples;
+      return velocity[n]->Sample(pos);
+    }
+
+    float4 operator()(const float4 &pos, const float s, AdvectionStats &stats) const
+    {
+      if (!blend || s >= 1.0f) {
+	return sampleField(1, pos, stats);
+      }
+      if (s <= 0.0f) {
+	return sampleField(0, pos, stats);
+      }
+      return (1.0f-s)*sampleField(0, pos, stats) + s*sampleField(1, pos, stats);
     }
+  };
+
+  float distance4(const float4 &a, const float4 &b)
+  {
+    float4 d = a - b;
+    return std::sqrt(d.x*d.x + d.y*d.y + d.z*d.z);
+  }
+
+  // All integrators advance a particle from time fraction s0 to s1 of the
+  // current time step, deltaT is the length of that interval. Those that
+  // sample the velocity only at the end of the interval take s1 alone.
+
+  // trapezoidal rule solved with fixed point iterations; with
+  // tolerance <= 0 all maxNumIter iterations are done, otherwise the
+  // iteration stops as soon as the position changes less than tolerance
+  float4 integrateTrapezoidal(const VelocitySampler &sample,
+			      const float4 &pos0, const float4 &velocity0,
+			      const float s1, const float deltaT,
+			      const int maxNumIter,
+			      const float tolerance, AdvectionStats &stats)
+  {
+    // initial guess - forward Euler
+    float4 pos1 = pos0 + deltaT*velocity0;
+
+    for (int i = 0; i < maxNumIter; ++i) {
 
-    float3 a = (1.0f-x)*vv[0] + x*vv[1];
-    float3 b = (1.0f-x)*vv[2] + x*vv[3];
-    float3 c = (1.0f-y)*a + y*b;
-    a = (1.0f-x)*vv[4] + x*vv[5];
-    b = (1.0f-x)*vv[6] + x*vv[7];
-    float3 d = (1.0f-y)*a + y*b;
+      float4 velocity1 = sample(pos1, s1, stats);
+      float4 velocity = (velocity0 + velocity1)/2.0f;
+      float4 pos1next = pos0 + deltaT*velocity;
+      ++stats.numIterations;
 
-    return (1.0f-z)*c + z*d;
+      bool converged = tolerance > 0.0f && distance4(pos1next, pos1) <= tolerance;
+      pos1 = pos1next;
+      if (converged) {
+	break;
+      }
+    }
+    return pos1;
   }
 
-  // connected-components
-  int uf_root(std::vector<int> &id, int i)
+  // Heun's method; the velocity at pos0 is known from the previous step
+  float4 integrateRK2(const VelocitySampler &sample,
+		      const float4 &pos0, const float4 &velocity0,
+		      const float s1, const float deltaT,
+		      AdvectionStats &stats)
   {
-    while (i != id[i]) {
-      id[i] = id[id[i]];
-      i = id[i];
+    float4 k2 = sample(pos0 + deltaT*velocity0, s1, stats);
+    ++stats.numIterations;
+    return pos0 + deltaT*(velocity0 + k2)/2.0f;
+  }
+
+  float4 integrateRK4(const VelocitySampler &sample,
+		      const float4 &pos0, const float4 &velocity0,
+		      const float s0, const float s1,
+		      const float deltaT, AdvectionStats &stats)
+  {
+    const float sh = (s0 + s1)/2.0f;
+    float4 k1 = velocity0;
+    float4 k2 = sample(pos0 + deltaT/2.0f*k1, sh, stats);
+    float4 k3 = sample(pos0 + deltaT/2.0f*k2, sh, stats);
+    float4 k4 = sample(pos0 + deltaT*k3, s1, stats);
+    ++stats.numIterations;
+    return pos0 + deltaT/6.0f*(k1 + 2.0f*k2 + 2.0f*k3 + k4);
+  }
+
+  // Runge-Kutta-Cash-Karp with adaptive sub-steps covering deltaT; a
+  // sub-step is accepted when the difference between the embedded 4th and
+  // 5th order solutions is below tolerance. The last of maxNumSteps
+  // sub-steps covers the rest of deltaT and is accepted regardless; such
+  // integrations are counted in stats.numForcedSteps
+  float4 integrateRK45(const VelocitySampler &sample,
+		       const float4 &pos0, const float4 &velocity0,
+		       const float s0, const float s1,
+		       const float deltaT, const float tolerance,
+		       AdvectionStats &stats)
+  {
+    const int maxNumSteps = 1000;
+    const float minStep = std::abs(deltaT)*1e-4f;
+    const float tol = tolerance > 0.0f ? tolerance : 1e-6f;
+    // time fraction of the step at time t
+    const float ds = deltaT != 0.0f ? (s1 - s0)/deltaT : 0.0f;
+
+    float4 pos = pos0;
+    float4 k1 = velocity0;
+    float t = 0.0f;
+    float h = deltaT;
+
+    for (int n = 0; n < maxNumSteps && std::abs(t) < std::abs(deltaT); ++n) {
+
+      const bool lastStep = n+1 == maxNumSteps;
+      if (lastStep || std::abs(t + h) > std::abs(deltaT)) {
+	h = deltaT - t;
+      }
+
+      float4 k2 = sample(pos + h*(1.0f/5.0f*k1),
+			 s0 + (t + h/5.0f)*ds, stats);
+      float4 k3 = sample(pos + h*(3.0f/40.0f*k1 + 9.0f/40.0f*k2),
+			 s0 + (t + h*3.0f/10.0f)*ds, stats);
+      float4 k4 = sample(pos + h*(3.0f/10.0f*k1 - 9.0f/10.0f*k2 + 6.0f/5.0f*k3),
+			 s0 + (t + h*3.0f/5.0f)*ds, stats);
+      float4 k5 = sample(pos + h*(-11.0f/54.0f*k1 + 5.0f/2.0f*k2 - 70.0f/27.0f*k3 +
+				  35.0f/27.0f*k4),
+			 s0 + (t + h)*ds, stats);
+      float4 k6 = sample(pos + h*(1631.0f/55296.0f*k1 + 175.0f/512.0f*k2 +
+				  575.0f/13824.0f*k3 + 44275.0f/110592.0f*k4 +
+				  253.0f/4096.0f*k5),
+			 s0 + (t + h*7.0f/8.0f)*ds, stats);
+      ++stats.numIterations;
+
+      float4 pos5 = pos + h*(37.0f/378.0f*k1 + 250.0f/621.0f*k3 +
+			     125.0f/594.0f*k4 + 512.0f/1771.0f*k6);
+      float4 pos4 = pos + h*(2825.0f/27648.0f*k1 + 18575.0f/48384.0f*k3 +
+			     13525.0f/55296.0f*k4 + 277.0f/14336.0f*k5 +
+			     1.0f/4.0f*k6);
+      float err = distance4(pos5, pos4);
+
+      const bool accepted = err <= tol || std::abs(h) <= minStep;
+      if (lastStep && !accepted) {
+	++stats.numForcedSteps;
+      }
+      if (accepted || lastStep) {
+	t += h;
+	pos = pos5;
+	if (std::abs(t) < std::abs(deltaT)) {
+	  k1 = sample(pos, s0 + t*ds, stats);
+	}
+      }
+
+      // standard step size control, limited to [0.2h, 5h]
+      float scale = err > 0.0f ? 0.9f*std::pow(tol/err, 0.2f) : 5.0f;
+      scale = std::min(std::max(scale, 0.2f), 5.0f);
+      h *= scale;
+      if (std::abs(h) < minStep) {
+	h = deltaT < 0.0f ? -minStep : minStep;
+      }
     }
-    return i;
+    return pos;
   }
 
-  bool uf_find(std::vector<int> &id, int p, int q)
+  // fixed point iterations of the trapezoidal integrators
+  const int maxNumIter = 20;
+
+  float4 integrate(const VelocitySampler &sample,
+		   const float4 &pos0, const float4 &velocity0,
+		   const float s0, const float s1, const float deltaT,
+		   const int integrator, const float tolerance,
+		   AdvectionStats &stats)
+  {
+    switch (integrator) {
+    case INTEGRATOR_TRAPEZOIDAL_CONVERGED:
+      return integrateTrapezoidal(sample, pos0, velocity0, s1, deltaT,
+				  maxNumIter, tolerance, stats);
+    case INTEGRATOR_RK2:
+      return integrateRK2(sample, pos0, velocity0, s1, deltaT, stats);
+    case INTEGRATOR_RK4:
+      return integrateRK4(sample, pos0, velocity0, s0, s1, deltaT, stats);
+    case INTEGRATOR_RK45:
+      return integrateRK45(sample, pos0, velocity0, s0, s1, deltaT,
+			   tolerance, stats);
+    case INTEGRATOR_TRAPEZOIDAL:
+    default:
+      return integrateTrapezoidal(sample, pos0, velocity0, s1, deltaT,
+				  maxNumIter, 0.0f, stats);
+    }
+  }
+
+  // INTEGRATOR_TRAPEZOIDAL without temporal interpolation does the same
+  // number of iterations for every particle, so the alive particles in
+  // [begin,end) are iterated in lockstep with the batched interpolation
+  // kernels; the result is the same as with integrateTrapezoidal
+  void integrateTrapezoidalBatch(const VelocitySampler &sample,
+				 ParticleStore &particles,
+				 const size_t begin, const size_t end,
+				 const float deltaT, ParticleBatch &batch,
+				 AdvectionStats &stats)
   {
-    return uf_root(id, p) == uf_root(id, q);
+    const int Size = ParticleBatch::Size;
+    size_t idx[Size];
+    float pos0[3][Size];
+    float velocity0[3][Size];
+    float pos1[3][Size];
+
+    int n = 0;
+    for (size_t p = begin; p < end && n < Size; ++p) {
+      if (!particles.IsAlive(p)) {
+	continue;
+      }
+      float4 pos = particles.GetPosition(p);
+      float4 vel = particles.GetVelocity(p);
+      pos0[0][n] = pos.x;
+      pos0[1][n] = pos.y;
+      pos0[2][n] = pos.z;
+      velocity0[0][n] = vel.x;
+      velocity0[1][n] = vel.y;
+      velocity0[2][n] = vel.z;
+      idx[n] = p;
+      ++n;
+    }
+
+    // initial guess - forward Euler
+    for (int c = 0; c < 3; ++c) {
+      for (int k = 0; k < n; ++k) {
+	pos1[c][k] = pos0[c][k] + deltaT*velocity0[c][k];
+      }
+    }
+
+    for (int i = 0; i < maxNumIter; ++i) {
+
+      batch.n = 0;
+      for (int k = 0; k < n; ++k) {
+	float x[3] = {pos1[0][k], pos1[1][k], pos1[2][k]};
+	batch.Add(sample.velocity[1]->GetLocator(), idx[k], x);
+      }
+      sample.velocity[1]->Interpolate(batch.n, batch.cells, batch.pcoords,
+				      batch.out);
+      for (int c = 0; c < 3; ++c) {
+	for (int k = 0; k < n; ++k) {
+	  pos1[c][k] = pos0[c][k] + deltaT*((velocity0[c][k] + batch.result[c][k])/2.0f);
+	}
+      }
+    }
+
+    for (int k = 0; k < n; ++k) {
+      particles.SetPosition(idx[k], make_float4(pos1[0][k], pos1[1][k], pos1[2][k], 1.0f));
+    }
+    stats.numParticles += n;
+    stats.numIterations += n*maxNumIter;
+    stats.numVelocitySamples += n*maxNumIter;
   }
 
-  void uf_unite(std::vector<int> &id, int p, int q)
+  // number of sub-steps such that a particle moves at most cflNumber cells
+  // per sub-step
+  int numSubSteps(const float speed, const float deltaT,
+		  const float cellSize, const float cflNumber)
   {
-    int i = uf_root(id, p);
-    int j = uf_root(id, q);
-    id[i] = j;
+    const int maxNumSubSteps = 256;
+
+    if (cflNumber <= 0.0f || cellSize <= 0.0f) {
+      return 1;
+    }
+    float cells = speed*std::abs(deltaT)/(cflNumber*cellSize);
+    int n = std::ceil(cells);
+    return std::min(std::max(n, 1), maxNumSubSteps);
   }
 
   class compare_float3 {
@@ -431,6 +776,25 @@ int findClosestTimeStep(double requestedTimeValue,
   return ts;
 }
 
+void buildLocator(vtkDataArray *coords[3], RectilinearLocator &locator)
+{
+  for (int c = 0; c < 3; ++c) {
+    std::vector<double> axis(coords[c]->GetNumberOfTuples());
+    for (int i = 0; i < axis.size(); ++i) {
+      axis[i] = coords[c]->GetComponent(i,0);
+    }
+    locator.SetAxis(c, axis.data(), axis.size());
+  }
+}
+
+void buildLocator(vtkRectilinearGrid *grid, RectilinearLocator &locator)
+{
+  vtkDataArray *coords[3] = {grid->GetXCoordinates(),
+			     grid->GetYCoordinates(),
+			     grid->GetZCoordinates()};
+  buildLocator(coords, locator);
+}
+
 void smoothSurface(std::vector<float3>& vertices,
 		   std::vector<int>& indices)
 {
@@ -465,31 +829,43 @@ void smoothSurface(std::vector<float3>& vertices,
   }
 }
 
-bool cellOnInterface(vtkDataArray *data, int res[3], int i, int j, int k)
+namespace
 {
-  int idx_left =   i-1 + j*res[0] +    k*res[0]*res[1];
-  int idx_right =  i+1 + j*res[0] +    k*res[0]*res[1];
-  int idx_bottom = i +  (j-1)*res[0] + k*res[0]*res[1];
-  int idx_top =    i +  (j+1)*res[0] + k*res[0]*res[1];
-  int idx_back =   i +   j*res[0] +   (k-1)*res[0]*res[1];
-  int idx_front =  i +   j*res[0] +   (k+1)*res[0]*res[1];
-  int idx = i + j*res[0] + k*res[0]*res[1];
-  float f = data->GetComponent(idx,0);
-  if (f > g_emf0 && f < g_emf1) {
-    return true;
-  }
-  else if (f >= g_emf1) {
-    if ((i-1 >= 0 && data->GetComponent(idx-1, 0) <= g_emf0) || 
-	(i+1 < res[0] && data->GetComponent(idx+1, 0) <= g_emf0) || 
-	(j-1 >= 0 && data->GetComponent(idx-res[0], 0) <= g_emf0) || 
-	(j+1 < res[1] && data->GetComponent(idx+res[0], 0) <= g_emf0) || 
-	(k-1 >= 0 && data->GetComponent(idx-res[0]*res[1], 0) <= g_emf0) || 
-	(k+1 < res[2] && data->GetComponent(idx+res[0]*res[1], 0) <= g_emf0)) {
-      return true;
+  template<typename T>
+  void seedCells(const T *data, const int cellRes[3],
+		 const std::vector<double> coordNodes[3],
+		 const std::vector<float> coordCenters[3],
+		 const int refinement, const double bounds[6],
+		 const int extent[6], vtkPoints *points,
+		 std::map<int3, int, bool(*)(const int3 &a, const int3 &b)> &seedPos,
+		 int &seedIdx)
+  {
+    int idx = 0;
+    for (int k = 0; k < cellRes[2]; ++k) {
+      for (int j = 0; j < cellRes[1]; ++j) {
+	for (int i = 0; i < cellRes[0]; ++i) {
+
+	  float f = fieldValue(data, idx);
+	  if (f > 0.0f) {
+	    float cellCenter[3] = {coordCenters[0][i],
+				   coordCenters[1][j],
+				   coordCenters[2][k]};
+	    float cellSize[3] = {coordNodes[0][i+1] - coordNodes[0][i],
+				 coordNodes[1][j+1] - coordNodes[1][j],
+				 coordNodes[2][k+1] - coordNodes[2][k]};
+
+	    float gradf[3];
+	    computeGradient(data, cellRes, i, j, k, coordCenters, gradf);
+
+	    placeSeeds(points, cellCenter, cellSize, refinement, f, gradf,
+		       bounds, i+extent[0], j+extent[2], k+extent[4], seedPos,
+		       seedIdx);
+	  }
+	  ++idx;
+	}
+      }
     }
   }
-
-  return false;
 }
 
 void generateSeedPoints(vtkRectilinearGrid *input,
@@ -511,23 +887,11 @@ void generateSeedPoints(vtkRectilinearGrid *input,
   input->GetDimensions(inputRes);
   int cellRes[3] = {inputRes[0]-1, inputRes[1]-1, inputRes[2]-1};
 
-  vtkDataArray *coordCenters[3];
-  vtkDataArray *coordNodes[3];
-
-  coordNodes[0] = input->GetXCoordinates();
-  coordNodes[1] = input->GetYCoordinates();
-  coordNodes[2] = input->GetZCoordinates();
-
-  for (int c = 0; c < 3; ++c) {
-    coordCenters[c] = vtkFloatArray::New();
-    coordCenters[c]->SetNumberOfComponents(1);
-    coordCenters[c]->SetNumberOfTuples(coordNodes[c]->GetNumberOfTuples()-1);
-    for (int i = 0; i < coordCenters[c]->GetNumberOfTuples(); ++i) {
-      coordCenters[c]->
-	SetComponent(i,0,(coordNodes[c]->GetComponent(0,i) + 
-			  coordNodes[c]->GetComponent(0,i+1))/2.0f);
-    }
-  }
+  std::vector<double> coordNodes[3];
+  std::vector<float> coordCenters[3];
+  getAxisCoordinates(input->GetXCoordinates(), coordNodes[0], coordCenters[0]);
+  getAxisCoordinates(input->GetYCoordinates(), coordNodes[1], coordCenters[1]);
+  getAxisCoordinates(input->GetZCoordinates(), coordNodes[2], coordCenters[2]);
 
   double bounds[6];
   input->GetBounds(bounds);
@@ -540,33 +904,19 @@ void generateSeedPoints(vtkRectilinearGrid *input,
 
   //---------------------------------------------------------------------------
   // populate the grid with seed points
-  int idx = 0;
-  for (int k = 0; k < cellRes[2]; ++k) {
-    for (int j = 0; j < cellRes[1]; ++j) {
-      for (int i = 0; i < cellRes[0]; ++i) {
-
-	float f = data->GetComponent(0,idx);
-	if (f > 0.0f) {
-	  float cellCenter[3] = {coordCenters[0]->GetComponent(i,0),
-				 coordCenters[1]->GetComponent(j,0),
-				 coordCenters[2]->GetComponent(k,0)};
-	  float cellSize[3] = {coordNodes[0]->GetComponent(i+1,0) - 
-			       coordNodes[0]->GetComponent(i,0),
-			       coordNodes[1]->GetComponent(j+1,0) - 
-			       coordNodes[1]->GetComponent(j,0),
-			       coordNodes[2]->GetComponent(k+1,0) - 
-			       coordNodes[2]->GetComponent(k,0)};
-
-	  float gradf[3];
-	  computeGradient(data, cellRes, i, j, k, coordCenters, gradf);
-
-	  placeSeeds(points, cellCenter, cellSize, refinement, f, gradf,
-		     bounds, i+extent[0], j+extent[2], k+extent[4], seedPos,
-		     seedIdx);
-	}
-  	++idx;
-      }
-    }
+  FieldView field;
+  field.Set(data, 0);
+  if (field.d) {
+    seedCells(field.d, cellRes, coordNodes, coordCenters, refinement, bounds,
+	      extent, points, seedPos, seedIdx);
+  }
+  else if (field.q) {
+    seedCells(field.q, cellRes, coordNodes, coordCenters, refinement, bounds,
+	      extent, points, seedPos, seedIdx);
+  }
+  else {
+    seedCells(field.f, cellRes, coordNodes, coordCenters, refinement, bounds,
+	      extent, points, seedPos, seedIdx);
   }
 
   connectivity->SetName("Connectivity");
@@ -605,34 +955,36 @@ void generateSeedPoints(vtkRectilinearGrid *input,
   }
 }
 
-void initVelocities(vtkRectilinearGrid *velocity,
-		    std::vector<float4> &particles,
-		    std::vector<float4> &velocities)
+void initVelocities(const VelocityCache &velocity,
+		    ParticleStore &particles,
+		    const int numThreads)
 {
-  int nodeRes[3];
-  velocity->GetDimensions(nodeRes);
-  int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
-  double x[3];
-  int ijk[3];
-  double pcoords[3];
-  int index;
-  vtkDataArray *velocityArray = 
-    velocity->GetCellData()->GetArray("Data", index);
-      // velocity->GetCellData()->GetAttribute(vtkDataSetAttributes::VECTORS);
-  if (index == -1) {
-    std::cout << __LINE__ << ": Array not found!" << std::endl;
-  }
-
-  std::vector<float4>::iterator itp = particles.begin();
-  std::vector<float4>::iterator itv = velocities.begin();
-  for (; itp != particles.end() && itv != velocities.end(); ++itp, ++itv) {
-
-    x[0] = itp->x;
-    x[1] = itp->y;
-    x[2] = itp->z;        
-    velocity->ComputeStructuredCoordinates(x, ijk, pcoords);
-    *itv = make_float4(interpolateVec(velocityArray, cellRes, ijk, pcoords),0.0f);
-  }
+  const RectilinearLocator &locator = velocity.GetLocator();
+
+  const float *px = particles.GetX();
+  const float *py = particles.GetY();
+  const float *pz = particles.GetZ();
+  float *vx = particles.GetVX();
+  float *vy = particles.GetVY();
+  float *vz = particles.GetVZ();
+
+  parallelFor(numThreads, particles.Size(), 4096,
+	      [&](size_t begin, size_t end, int) {
+
+    ParticleBatch batch;
+    for (size_t b = begin; b < end; b += ParticleBatch::Size) {
+
+      batch.n = 0;
+      const size_t bend = std::min(b + ParticleBatch::Size, end);
+      for (size_t p = b; p < bend; ++p) {
+	float x[3] = {px[p], py[p], pz[p]};
+	batch.Add(locator, p, x);
+      }
+      // the batch is contiguous, so the velocities go straight to the store
+      float *out[3] = {vx + b, vy + b, vz + b};
+      velocity.Interpolate(batch.n, batch.cells, batch.pcoords, out);
+    }
+  });
 }
 
 float dot(float* a, float* b)
@@ -669,79 +1021,72 @@ void cross(float* a, float* b, float* c)
 
 #define PI 3.14159265
 
-void computeNormals(int nodeRes[3],
-		    std::vector<float> &dx,
-		    std::vector<float> &dy,
-		    std::vector<float> &dz, 
-		    vtkDataArray *f,
-		    std::vector<float> &normals)
+// normal of the volume fraction gradient at node (i,j,k), pointing from
+// the liquid outwards; the cells outside the grid repeat the boundary cells
+template<typename T>
+void nodeNormal(const int cellRes[3],
+		const std::vector<float> &dx,
+		const std::vector<float> &dy,
+		const std::vector<float> &dz, 
+		const T *f,
+		const int i, const int j, const int k,
+		float normal[3])
 {
-  // const double contact = 90;
-  int i, j, k;
   float dfm1, dfm2;
 
-  int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
-
-  for (k = 0; k < nodeRes[2]; k++) {
-    int km = k - 1;
-    int kp = k;
-    if (km < 0) 
-      km = 0;
-    if (kp > cellRes[2]-1) 
-      kp = cellRes[2]-1;
-
-    float dzc = (dz[km] + dz[kp])*0.5f;
-    
-    for (j = 0; j < nodeRes[1]; j++) {
-      int jm = j - 1;
-      int jp = j;
-      if (jm < 0) 
-	jm = 0;
-      if (jp > cellRes[1]-1) 
-      	jp = cellRes[1]-1;
-
-      float dyc = (dy[jm] + dy[jp])*0.5f;
-
-      for (i = 0; i < nodeRes[0]; i++) {
-	int im = i - 1;
-	int ip = i;
-	if (im < 0) 
-	  im = 0;
-	if (ip > cellRes[0]-1) 
-	  ip = cellRes[0]-1;
-	
-	float dxc = (dx[im] + dx[ip])*0.5f;
-
-	float fs[8] = {f->GetComponent(im + jm*cellRes[0] + km*cellRes[0]*cellRes[1], 0),
-		       f->GetComponent(ip + jm*cellRes[0] + km*cellRes[0]*cellRes[1], 0),
-		       f->GetComponent(im + jp*cellRes[0] + km*cellRes[0]*cellRes[1], 0),
-		       f->GetComponent(ip + jp*cellRes[0] + km*cellRes[0]*cellRes[1], 0),
-		       f->GetComponent(im + jm*cellRes[0] + kp*cellRes[0]*cellRes[1], 0),
-		       f->GetComponent(ip + jm*cellRes[0] + kp*cellRes[0]*cellRes[1], 0),
-		       f->GetComponent(im + jp*cellRes[0] + kp*cellRes[0]*cellRes[1], 0),
-		       f->GetComponent(ip + jp*cellRes[0] + kp*cellRes[0]*cellRes[1], 0)};
-
-
-	dfm1 = (fs[7] - fs[6])*dz[km] + (fs[3] - fs[2])*dz[kp];
-	dfm2 = (fs[5] - fs[4])*dz[km] + (fs[1] - fs[0])*dz[kp];
-	float nx = 0.25f*(dfm1*dy[j]+dfm2*dy[jp]) / (dxc*dyc*dzc);
-
-	dfm1 = (fs[7] - fs[5])*dz[km] + (fs[3] - fs[1])*dz[kp];
-	dfm2 = (fs[6] - fs[4])*dz[km] + (fs[2] - fs[0])*dz[kp];
-	float ny = 0.25f*(dfm1*dx[i]+dfm2*dx[ip]) / (dxc*dyc*dzc);
-
-	dfm1 = (fs[7] - fs[3])*dy[jm] + (fs[5] - fs[1])*dy[jp];
-	dfm2 = (fs[6] - fs[2])*dy[jm] + (fs[4] - fs[0])*dy[jp];
-	float nz = 0.25f*(dfm1*dx[i]+dfm2*dx[ip]) / (dxc*dyc*dzc);
-
-	int offset = i+j*nodeRes[0]+k*nodeRes[0]*nodeRes[1];
-
-	normals[offset*3+0] = -nx;// normal points from f outwards
-	normals[offset*3+1] = -ny;
-	normals[offset*3+2] = -nz;
-      }
-    }
-  }
+  int km = k - 1;
+  int kp = k;
+  if (km < 0) 
+    km = 0;
+  if (kp > cellRes[2]-1) 
+    kp = cellRes[2]-1;
+
+  float dzc = (dz[km] + dz[kp])*0.5f;
+
+  int jm = j - 1;
+  int jp = j;
+  if (jm < 0) 
+    jm = 0;
+  if (jp > cellRes[1]-1) 
+    jp = cellRes[1]-1;
+
+  float dyc = (dy[jm] + dy[jp])*0.5f;
+
+  int im = i - 1;
+  int ip = i;
+  if (im < 0) 
+    im = 0;
+  if (ip > cellRes[0]-1) 
+    ip = cellRes[0]-1;
+
+  float dxc = (dx[im] + dx[ip])*0.5f;
+
+  float fs[8] = {fieldValue(f, im + jm*cellRes[0] + km*cellRes[0]*cellRes[1]),
+		 fieldValue(f, ip + jm*cellRes[0] + km*cellRes[0]*cellRes[1]),
+		 fieldValue(f, im + jp*cellRes[0] + km*cellRes[0]*cellRes[1]),
+		 fieldValue(f, ip + jp*cellRes[0] + km*cellRes[0]*cellRes[1]),
+		 fieldValue(f, im + jm*cellRes[0] + kp*cellRes[0]*cellRes[1]),
+		 fieldValue(f, ip + jm*cellRes[0] + kp*cellRes[0]*cellRes[1]),
+		 fieldValue(f, im + jp*cellRes[0] + kp*cellRes[0]*cellRes[1]),
+		 fieldValue(f, ip + jp*cellRes[0] + kp*cellRes[0]*cellRes[1])};
+
+  // dx[ip] and dy[jp] are dx[i] and dy[j] inside the grid and stay in the
+  // arrays on the last nodes
+  dfm1 = (fs[7] - fs[6])*dz[km] + (fs[3] - fs[2])*dz[kp];
+  dfm2 = (fs[5] - fs[4])*dz[km] + (fs[1] - fs[0])*dz[kp];
+  float nx = 0.25f*(dfm1*dy[jp]+dfm2*dy[jp]) / (dxc*dyc*dzc);
+
+  dfm1 = (fs[7] - fs[5])*dz[km] + (fs[3] - fs[1])*dz[kp];
+  dfm2 = (fs[6] - fs[4])*dz[km] + (fs[2] - fs[0])*dz[kp];
+  float ny = 0.25f*(dfm1*dx[ip]+dfm2*dx[ip]) / (dxc*dyc*dzc);
+
+  dfm1 = (fs[7] - fs[3])*dy[jm] + (fs[5] - fs[1])*dy[jp];
+  dfm2 = (fs[6] - fs[2])*dy[jm] + (fs[4] - fs[0])*dy[jp];
+  float nz = 0.25f*(dfm1*dx[ip]+dfm2*dx[ip]) / (dxc*dyc*dzc);
+
+  normal[0] = -nx;// normal points from f outwards
+  normal[1] = -ny;
+  normal[2] = -nz;
 }
 
 float computeLstar(float f, float n[3], float d[3])
@@ -903,81 +1248,142 @@ float computeLstar(float f, float n[3], float d[3])
   return lstar;
 }
 
-void computeL(int cellRes[3],
-	      std::vector<float> &dx,
-	      std::vector<float> &dy,
-	      std::vector<float> &dz, 
-	      vtkDataArray *f,
-	      std::vector<float> &normals,
-	      std::vector<float> &lstar,
-	      std::vector<float> &normalsInt)
+// PLIC planes of the interface cells of index within [lo,hi), stored in
+// planes with 4 floats per slot of the index: the normal of the cell, the
+// average of its 8 node normals, and the interface distance. The planes of
+// the other slots are zero. Full cells need no plane, they are seeded
+// everywhere
+template<typename T>
+void reconstructPLIC(const int cellRes[3],
+		     const std::vector<float> &dx,
+		     const std::vector<float> &dy,
+		     const std::vector<float> &dz, 
+		     const T *f,
+		     const InterfaceIndex &index,
+		     const int lo[3], const int hi[3],
+		     const int numThreads,
+		     std::vector<float> &planes)
 {
-  //  int no = 0;
-  int w, h, d;
-  w = cellRes[0];
-  h = cellRes[1];
-  d = cellRes[2];
-
-  for (int k = 0; k < d; k++) {
-    for (int j = 0; j < h; j++) {
-      for (int i = 0; i < w; i++) {
-	int fo = i + j*w + k*w*h;
-
-	// The correct normals vector is computed as an average of 
-	// 8 corners;
-	int n0 = i   + (j  )*(w+1) + (k  )*(w+1)*(h+1);
-	int n1 = i+1 + (j  )*(w+1) + (k  )*(w+1)*(h+1);
-	int n2 = i   + (j+1)*(w+1) + (k  )*(w+1)*(h+1);
-	int n3 = i+1 + (j+1)*(w+1) + (k  )*(w+1)*(h+1);
-	int n4 = i   + (j  )*(w+1) + (k+1)*(w+1)*(h+1);
-	int n5 = i+1 + (j  )*(w+1) + (k+1)*(w+1)*(h+1);
-	int n6 = i   + (j+1)*(w+1) + (k+1)*(w+1)*(h+1);
-	int n7 = i+1 + (j+1)*(w+1) + (k+1)*(w+1)*(h+1);
-
-	float ns[8][3] = {{normals[n0*3+0], normals[n0*3+1], normals[n0*3+2]},
-			  {normals[n1*3+0], normals[n1*3+1], normals[n1*3+2]},
-			  {normals[n2*3+0], normals[n2*3+1], normals[n2*3+2]},
-			  {normals[n3*3+0], normals[n3*3+1], normals[n3*3+2]},
-			  {normals[n4*3+0], normals[n4*3+1], normals[n4*3+2]},
-			  {normals[n5*3+0], normals[n5*3+1], normals[n5*3+2]},
-			  {normals[n6*3+0], normals[n6*3+1], normals[n6*3+2]},
-			  {normals[n7*3+0], normals[n7*3+1], normals[n7*3+2]}};
-
-	float n[3] = {0.0f, 0.0f, 0.0f};
-
-	for (int l = 0; l < 8; l++)
-	  {
-	    n[0] += ns[l][0];
-	    n[1] += ns[l][1];
-	    n[2] += ns[l][2];
-	  } 
-	float len = sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
-	if (len)
-	  {
-	    n[0] /= len;
-	    n[1] /= len;
-	    n[2] /= len;
-	  }
-
-	normalsInt[fo*3+0] = n[0];
-	normalsInt[fo*3+1] = n[1];
-	normalsInt[fo*3+2] = n[2];
+  const std::vector<int> &cells = index.GetCells();
+  const int w = cellRes[0];
+  const int h = cellRes[1];
+  planes.assign(cells.size()*4, 0.0f);
+
+  parallelFor(numThreads, cells.size(), 256,
+	      [&](size_t begin, size_t end, int) {
+    for (size_t c = begin; c < end; ++c) {
+      const int fo = cells[c];
+      const int i = fo%w;
+      const int j = (fo/w)%h;
+      const int k = fo/(w*h);
+      if (i < lo[0] || i >= hi[0] || j < lo[1] || j >= hi[1] ||
+	  k < lo[2] || k >= hi[2]) {
+	continue;
+      }
 
-	float dd[3] = {dx[i], dy[j], dz[k]};
-	
-	if (f->GetComponent(fo,0) > g_emf0 && f->GetComponent(fo,0) < g_emf1) {
-	  lstar[fo] = computeLstar(f->GetComponent(fo,0), n, dd);
+      // The correct normals vector is computed as an average of 
+      // 8 corners;
+      float n[3] = {0.0f, 0.0f, 0.0f};
+      for (int l = 0; l < 8; l++) {
+	float ns[3];
+	nodeNormal(cellRes, dx, dy, dz, f, i+(l&1), j+((l>>1)&1), k+(l>>2), ns);
+	n[0] += ns[0];
+	n[1] += ns[1];
+	n[2] += ns[2];
+      } 
+      float len = sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
+      if (len)
+	{
+	  n[0] /= len;
+	  n[1] /= len;
+	  n[2] /= len;
 	}
-	else if (f->GetComponent(fo,0) >= g_emf1) {
-	  if (f->GetComponent(fo-1,0) < g_emf0 || f->GetComponent(fo+1,0) < g_emf0 || 
-	      f->GetComponent(fo-w,0) < g_emf0 || f->GetComponent(fo+w,0) < g_emf0 || 
-	      f->GetComponent(fo-w*h,0) < g_emf0 || f->GetComponent(fo+w*h,0) < g_emf0) {
-	    lstar[fo] = computeLstar(f->GetComponent(fo,0), n, dd);
+
+      float dd[3] = {dx[i], dy[j], dz[k]};
+      planes[c*4+0] = n[0];
+      planes[c*4+1] = n[1];
+      planes[c*4+2] = n[2];
+      planes[c*4+3] = computeLstar(fieldValue(f, fo), n, dd);
+    }
+  });
+}
+
+namespace
+{
+  // PLIC planes of the interface cells and seeds of all liquid cells owned
+  // by this process (ghost cells excluded)
+  template<typename T>
+  void seedCellsPLIC(const T *vof, const OccupancyMask &mask,
+		     const InterfaceIndex &index, const int numThreads,
+		     const int cellRes[3],
+		     const std::vector<double> coordNodes[3],
+		     const std::vector<float> coordCenters[3],
+		     const int refinement, const double bounds[6],
+		     const int extent[6], const int globalExtent[6],
+		     const int numGhostLevels, vtkPoints *points,
+		     std::map<int3, int, bool(*)(const int3 &a, const int3 &b)> &seedPos,
+		     int &seedIdx)
+  {
+    std::vector<std::vector<float> > dx(3);
+    dx[0].resize(cellRes[0]);
+    dx[1].resize(cellRes[1]);
+    dx[2].resize(cellRes[2]);
+
+    for (int c = 0; c < 3; ++c) {
+      for (int i = 0; i < cellRes[c]; ++i) {
+	dx[c][i] = coordNodes[c][i+1] - coordNodes[c][i];
+      }
+    }
+
+    //---------------------------------------------------------------------------
+    // populate the grid with seed points
+    // int idx = 0;
+    float cellCenter[3];
+    float cellSize[3];
+
+    int imin = extent[0] > globalExtent[0] ? numGhostLevels : 0;
+    int imax = extent[1] < globalExtent[1] ? cellRes[0]-numGhostLevels : cellRes[0];
+    int jmin = extent[2] > globalExtent[2] ? numGhostLevels : 0;
+    int jmax = extent[3] < globalExtent[3] ? cellRes[1]-numGhostLevels : cellRes[1];
+    int kmin = extent[4] > globalExtent[4] ? numGhostLevels : 0;
+    int kmax = extent[5] < globalExtent[5] ? cellRes[2]-numGhostLevels : cellRes[2];
+
+    const int lo[3] = {imin, jmin, kmin};
+    const int hi[3] = {imax, jmax, kmax};
+    std::vector<float> planes;
+    reconstructPLIC(cellRes, dx[0], dx[1], dx[2], vof, index, lo, hi,
+		    numThreads, planes);
+
+    // the liquid cells are visited in index order, so the slots of the
+    // interface cells follow in order
+    const std::vector<int> &interfaceCells = index.GetCells();
+    size_t slot = 0;
+    const float fullPlane[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    for (int k = kmin; k < kmax; ++k) {
+      cellCenter[2] = coordCenters[2][k];
+      cellSize[2] = coordNodes[2][k+1] - coordNodes[2][k];
+
+      for (int j = jmin; j < jmax; ++j) {      
+	cellCenter[1] = coordCenters[1][j];
+	cellSize[1] = coordNodes[1][j+1] - coordNodes[1][j];
+
+	mask.ForEach(OccupancyMask::LIQUID, j, k, imin, imax, [&](int i) {
+	  cellCenter[0] = coordCenters[0][i];
+	  cellSize[0] = coordNodes[0][i+1] - coordNodes[0][i];
+
+	  int idx = i + j*cellRes[0] + k*cellRes[0]*cellRes[1];
+	  const bool full = mask.IsFull(i, j, k);
+	  const float *plane = fullPlane;
+	  if (!full) {
+	    while (interfaceCells[slot] < idx) {
+	      ++slot;
+	    }
+	    plane = &planes[slot*4];
 	  }
-	}
-	else { 
-	  lstar[fo] = 0.0f;
-	}
+	  placeSeedsPLIC(points, cellCenter, cellSize, refinement, cellRes, full, plane,
+			 bounds, i, j, k, seedPos, seedIdx);
+	});
       }
     }
   }
@@ -989,66 +1395,27 @@ void generateSeedPointsPLIC(vtkRectilinearGrid *vofGrid,
 			    vtkIntArray *connectivity,
 			    vtkShortArray *coords,
 			    int globalExtent[6],
-			    int numGhostLevels)
+			    int numGhostLevels,
+			    const OccupancyMask &mask,
+			    const InterfaceIndex &interfaceIndex,
+			    const BrickedVolume *vofBricks,
+			    const int numThreads)
 {
   int index;
   vtkDataArray *vofArray =
     vofGrid->GetCellData()->GetArray("Data", index);
-  if (index == -1) {
+  if (index == -1 && vofBricks == 0) {
     std::cout << __LINE__ << ": Array not found!" << std::endl;
   }
   
-  vtkDataArray *coordNodes[3] = {vofGrid->GetXCoordinates(),
-				 vofGrid->GetYCoordinates(),
-				 vofGrid->GetZCoordinates()};
-  int nodeRes[3] = {coordNodes[0]->GetNumberOfTuples(),
-		    coordNodes[1]->GetNumberOfTuples(),
-		    coordNodes[2]->GetNumberOfTuples()};
-  int cellRes[3] = {nodeRes[0]-1,nodeRes[1]-1,nodeRes[2]-1};
-  
-  std::vector<std::vector<float> > dx(3);
-  dx[0].resize(cellRes[0]);
-  dx[1].resize(cellRes[1]);
-  dx[2].resize(cellRes[2]);
-
-  for (int c = 0; c < 3; ++c) {
-    for (int i = 0; i < cellRes[c]; ++i) {
-      dx[c][i] = coordNodes[c]->GetComponent(i+1,0) - coordNodes[c]->GetComponent(i,0);
-    }
-  }
-
-  std::vector<float> normals;  
-  normals.resize(nodeRes[0]*nodeRes[1]*nodeRes[2]*3);
-
-  computeNormals(nodeRes, dx[0], dx[1], dx[2], vofArray, normals);
-
-  std::vector<float> lstar(cellRes[0]*cellRes[1]*cellRes[2]);
-  std::vector<float> normalsInt(cellRes[0]*cellRes[1]*cellRes[2]*3);
-  computeL(cellRes, dx[0], dx[1], dx[2], vofArray, normals, lstar, normalsInt);
-
-  //--------------
-  vtkDataArray *data =
-    vofGrid->GetCellData()->GetArray("Data", index);
-  if (index == -1) {
-    std::cout << __LINE__ << ": Array not found!" << std::endl;
-  }
-  
-  // vtkDataArray *data =
-  //   vofGrid->GetCellData()->GetAttribute(vtkDataSetAttributes::SCALARS);
-  int inputRes[3];
-  vofGrid->GetDimensions(inputRes);
-  vtkDataArray *coordCenters[3];
-
-  for (int c = 0; c < 3; ++c) {
-    coordCenters[c] = vtkFloatArray::New();
-    coordCenters[c]->SetNumberOfComponents(1);
-    coordCenters[c]->SetNumberOfTuples(coordNodes[c]->GetNumberOfTuples()-1);
-    for (int i = 0; i < coordCenters[c]->GetNumberOfTuples(); ++i) {
-      coordCenters[c]->
-	SetComponent(i,0,(coordNodes[c]->GetComponent(0,i) + 
-			  coordNodes[c]->GetComponent(0,i+1))/2.0f);
-    }
-  }
+  std::vector<double> coordNodes[3];
+  std::vector<float> coordCenters[3];
+  getAxisCoordinates(vofGrid->GetXCoordinates(), coordNodes[0], coordCenters[0]);
+  getAxisCoordinates(vofGrid->GetYCoordinates(), coordNodes[1], coordCenters[1]);
+  getAxisCoordinates(vofGrid->GetZCoordinates(), coordNodes[2], coordCenters[2]);
+  int cellRes[3] = {int(coordCenters[0].size()),
+		    int(coordCenters[1].size()),
+		    int(coordCenters[2].size())};
 
   double bounds[6];
   vofGrid->GetBounds(bounds);
@@ -1059,46 +1426,27 @@ void generateSeedPointsPLIC(vtkRectilinearGrid *vofGrid,
   seedPos.clear();
   int seedIdx = 0;
 
-  //---------------------------------------------------------------------------
-  // populate the grid with seed points
-  // int idx = 0;
-  float cellCenter[3];
-  float cellSize[3];
-
-  int imin = extent[0] > globalExtent[0] ? numGhostLevels : 0;
-  int imax = extent[1] < globalExtent[1] ? cellRes[0]-numGhostLevels : cellRes[0];
-  int jmin = extent[2] > globalExtent[2] ? numGhostLevels : 0;
-  int jmax = extent[3] < globalExtent[3] ? cellRes[1]-numGhostLevels : cellRes[1];
-  int kmin = extent[4] > globalExtent[4] ? numGhostLevels : 0;
-  int kmax = extent[5] < globalExtent[5] ? cellRes[2]-numGhostLevels : cellRes[2];
-
-  int kcur = kmin;
-  for (int k = kmin; k < kmax; ++k) {
-    cellCenter[2] = coordCenters[2]->GetComponent(kcur,0);
-    cellSize[2] = coordNodes[2]->GetComponent(kcur+1,0) - coordNodes[2]->GetComponent(kcur,0);
-
-    int jcur = jmin;
-    for (int j = jmin; j < jmax; ++j) {      
-      cellCenter[1] = coordCenters[1]->GetComponent(jcur,0);
-      cellSize[1] = coordNodes[1]->GetComponent(jcur+1,0) - coordNodes[1]->GetComponent(jcur,0);
-
-      int icur = imin;
-      for (int i = imin; i < imax; ++i) {	
-	cellCenter[0] = coordCenters[0]->GetComponent(icur,0);
-	cellSize[0] = coordNodes[0]->GetComponent(icur+1,0) - coordNodes[0]->GetComponent(icur,0);
-
-	int idx = i + j*cellRes[0] + k*cellRes[0]*cellRes[1];
-	float f = data->GetComponent(0,idx);
-	if (f > g_emf0) {
-
-	  placeSeedsPLIC(points, cellCenter, cellSize, refinement, cellRes, f, lstar, normalsInt,
-			 bounds, i, j, k, idx, seedPos, seedIdx);
-	}
-	++icur;
-      }
-      ++jcur;
-    }
-    ++kcur;
+  FieldView vof;
+  vof.Set(vofArray, vofBricks);
+  if (vof.d) {
+    seedCellsPLIC(vof.d, mask, interfaceIndex, numThreads, cellRes, coordNodes,
+		  coordCenters, refinement, bounds, extent, globalExtent,
+		  numGhostLevels, points, seedPos, seedIdx);
+  }
+  else if (vof.b) {
+    seedCellsPLIC(vof.b, mask, interfaceIndex, numThreads, cellRes, coordNodes,
+		  coordCenters, refinement, bounds, extent, globalExtent,
+		  numGhostLevels, points, seedPos, seedIdx);
+  }
+  else if (vof.q) {
+    seedCellsPLIC(vof.q, mask, interfaceIndex, numThreads, cellRes, coordNodes,
+		  coordCenters, refinement, bounds, extent, globalExtent,
+		  numGhostLevels, points, seedPos, seedIdx);
+  }
+  else {
+    seedCellsPLIC(vof.f, mask, interfaceIndex, numThreads, cellRes, coordNodes,
+		  coordCenters, refinement, bounds, extent, globalExtent,
+		  numGhostLevels, points, seedPos, seedIdx);
   }
 
   connectivity->SetName("Connectivity");
@@ -1137,80 +1485,314 @@ void generateSeedPointsPLIC(vtkRectilinearGrid *vofGrid,
   }
 }
 
+void compressVof(vtkRectilinearGrid *vofGrid)
+{
+  int index;
+  vtkDataArray *data = vofGrid->GetCellData()->GetArray("Data", index);
+  if (data == NULL) {
+    std::cout << __LINE__ << ": Array not found!" << std::endl;
+    return;
+  }
+  if (data->IsA("vtkSignedCharArray")) {
+    return;
+  }
+
+  const int numCells = data->GetNumberOfTuples();
+  vtkSignedCharArray *compressed = vtkSignedCharArray::New();
+  compressed->SetName("Data");
+  compressed->SetNumberOfComponents(1);
+  compressed->SetNumberOfTuples(numCells);
+  signed char *q = compressed->GetPointer(0);
+  for (int i = 0; i < numCells; ++i) {
+    const double f = data->GetComponent(i,0);
+    if (f <= g_emf0) {
+      q[i] = 0;
+    }
+    else if (f >= g_emf1) {
+      q[i] = 127;
+    }
+    else {
+      // interface cells must not become empty or full
+      q[i] = std::min(std::max(int(f*127.0 + 0.5), 1), 126);
+    }
+  }
+  vofGrid->GetCellData()->RemoveArray("Data");
+  vofGrid->GetCellData()->SetScalars(compressed);
+  compressed->Delete();
+}
+
+void buildOccupancyMask(vtkRectilinearGrid *vofGrid, OccupancyMask &mask,
+			const int numThreads)
+{
+  int index;
+  vtkDataArray *data = vofGrid->GetCellData()->GetArray("Data", index);
+  if (data == NULL) {
+    std::cout << __LINE__ << ": Array not found!" << std::endl;
+    mask.Clear();
+    return;
+  }
+  int res[3];
+  vofGrid->GetDimensions(res);
+  res[0] -= 1;
+  res[1] -= 1;
+  res[2] -= 1;
+
+  FieldView vof;
+  vof.Set(data, 0);
+  if (vof.d) {
+    mask.Build(vof.d, res, g_emf0, g_emf1, numThreads);
+  }
+  else if (vof.q) {
+    mask.Build(vof.q, res, g_emf0*127.0, g_emf1*127.0, numThreads);
+  }
+  else {
+    mask.Build(vof.f, res, g_emf0, g_emf1, numThreads);
+  }
+}
+
+void buildBrickedVolume(vtkRectilinearGrid *vofGrid, BrickedVolume &bricks,
+			const int numThreads)
+{
+  int index;
+  vtkDataArray *data = vofGrid->GetCellData()->GetArray("Data", index);
+  if (data == NULL) {
+    std::cout << __LINE__ << ": Array not found!" << std::endl;
+    bricks.Clear();
+    return;
+  }
+  int res[3];
+  vofGrid->GetDimensions(res);
+  res[0] -= 1;
+  res[1] -= 1;
+  res[2] -= 1;
+
+  FieldView vof;
+  vof.Set(data, 0);
+  if (vof.d) {
+    bricks.Build(vof.d, res, g_emf0, g_emf1, 1.0f, numThreads);
+  }
+  else if (vof.q) {
+    bricks.Build(vof.q, res, g_emf0*127.0, g_emf1*127.0, 1.0f/127.0f,
+		 numThreads);
+  }
+  else {
+    bricks.Build(vof.f, res, g_emf0, g_emf1, 1.0f, numThreads);
+  }
+}
+
+// the default integrator is the trapezoidal rule,
 // iterative, solved with fixed point method - Newton's method can be viewed as such
 // https://en.wikipedia.org/wiki/Fixed-point_iteration
 // https://en.wikipedia.org/wiki/Trapezoidal_rule_%28differential_equations%29
+// particles are independent, so they are distributed over numThreads threads
+// in chunks; the result does not depend on the number of threads
 void advectParticles(vtkRectilinearGrid *vofGrid,
-		     vtkRectilinearGrid *velocityGrid,
-		     std::vector<float4> &particles,
-		     std::vector<float4> &velocities,		     
-		     const float deltaT)
+		     const BrickedVolume *vofBricks,
+		     const VelocityCache velocity[2],
+		     ParticleStore &particles,
+		     const float deltaT,
+		     const AdvectionParams &params,
+		     AdvectionStats &stats)
 {
   int nodeRes[3];
   vofGrid->GetDimensions(nodeRes);
   int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
-  int index;
-  vtkDataArray *velocityArray1 = velocityGrid->GetCellData()->GetArray("Data", index);
-    if (index == -1) {
-    std::cout << __LINE__ << ": Array not found!" << std::endl;
-  }
 
+  VelocitySampler sample;
+  sample.blend = params.temporalInterpolation != 0;
+  sample.velocity[0] = &velocity[0];
+  sample.velocity[1] = &velocity[1];
+
+  int index;
   // vtkDataArray *velocityArray1 = velocityGrid->GetCellData()->GetAttribute(vtkDataSetAttributes::VECTORS);
   vtkDataArray *vofArray1 = vofGrid->GetCellData()->GetArray("Data", index);
-  if (index == -1) {
+  if (index == -1 && vofBricks == 0) {
     std::cout << __LINE__ << ": Array not found!" << std::endl;
   }
   // vtkDataArray *vofArray1 = vofGrid->GetCellData()->GetAttribute(vtkDataSetAttributes::SCALARS);
+  FieldView vofField1;
+  vofField1.Set(vofArray1, vofBricks);
+
+  RectilinearLocator vofLocator;
+  buildLocator(vofGrid, vofLocator);
+
+  // cell sizes for the CFL condition of the sub-cycling
+  std::vector<std::vector<float> > cellSizes(3);
+  if (sample.blend) {
+    for (int c = 0; c < 3; ++c) {
+      const std::vector<double> &coords = velocity[1].GetLocator().GetCoordinates(c);
+      const int numCells = velocity[1].GetCellRes()[c];
+      cellSizes[c].resize(std::max(numCells, 1), 0.0f);
+      for (int i = 0; i < numCells; ++i) {
+	cellSizes[c][i] = coords[i+1] - coords[i];
+      }
+    }
+  }
 
-  std::vector<float4>::iterator itp = particles.begin();
-  std::vector<float4>::iterator itv = velocities.begin();
-  for (; itp != particles.end() && itv != velocities.end(); ++itp, ++itv) {
+  const bool lockstep = !sample.blend && params.integrator == INTEGRATOR_TRAPEZOIDAL;
+  const size_t numParticles = particles.Size();
+  const size_t chunkSize = 4096;
 
-    if (itp->w == 0.0f) {
-      continue;
-    }
-    double x[3];
-    int ijk[3];
-    double pcoords[3];
-    const int maxNumIter = 20;
+  // one set of counters per thread, summed up at the end
+  std::vector<AdvectionStats> threadStats(resolveNumThreads(params.numThreads));
 
-    float4 pos0 = *itp;
-    float4 velocity0 = *itv;
-    // initial guess - forward Euler
-    float4 pos1 = pos0 + deltaT*velocity0;
-    float4 velocity1;
-      
-    for (int i = 0; i < maxNumIter; ++i) {
+  parallelFor(params.numThreads, numParticles, chunkSize,
+	      [&](size_t begin, size_t end, int threadId) {
 
-      x[0] = pos1.x;
-      x[1] = pos1.y;
-      x[2] = pos1.z;
-      velocityGrid->ComputeStructuredCoordinates(x, ijk, pcoords);
-      velocity1 = make_float4(interpolateVec(velocityArray1, cellRes, ijk, pcoords),0.0f);
-      float4 velocity = (velocity0 + velocity1)/2.0f;
-      pos1 = pos0 + deltaT*velocity;	
-    }      
-    *itp = pos1;
-
-    x[0] = itp->x;
-    x[1] = itp->y;
-    x[2] = itp->z;
-    int particleInsideGrid = vofGrid->ComputeStructuredCoordinates(x, ijk, pcoords);
-    velocity1 = make_float4(interpolateVec(velocityArray1, cellRes, ijk, pcoords),0.0f);
-    *itv = velocity1;
-        
-    if (particleInsideGrid) {
-      int idx = ijk[0] + ijk[1]*cellRes[0] + ijk[2]*cellRes[0]*cellRes[1];
-      float f = vofArray1->GetComponent(idx, 0);
-
-      if (f <= g_emf0) {
-	itp->w = 0.0f;
+    AdvectionStats &localStats = threadStats[threadId];
+    ParticleBatch batch;
+
+    for (size_t b = begin; b < end; b += ParticleBatch::Size) {
+
+      const size_t bend = std::min(b + ParticleBatch::Size, end);
+
+      if (lockstep) {
+	integrateTrapezoidalBatch(sample, particles, b, bend, deltaT,
+				  batch, localStats);
+      }
+      else {
+	for (size_t p = b; p < bend; ++p) {
+
+	  if (!particles.IsAlive(p)) {
+	    continue;
+	  }
+	  ++localStats.numParticles;
+
+	  float4 pos0 = particles.GetPosition(p);
+	  float4 velocity0 = particles.GetVelocity(p);
+	  float4 pos1;
+
+	  if (!sample.blend) {
+	    pos1 = integrate(sample, pos0, velocity0, 0.0f, 1.0f, deltaT,
+			     params.integrator, params.tolerance, localStats);
+	  }
+	  else {
+	    // sub-cycle the time step according to the fastest of the two
+	    // velocities at the start position and the local cell size
+	    double x[3] = {pos0.x, pos0.y, pos0.z};
+	    int ijk[3];
+	    double pcoords[3];
+	    velocity[1].GetLocator().FindCell(x, ijk, pcoords);
+	    float cellSize = std::min(cellSizes[0][ijk[0]],
+				      std::min(cellSizes[1][ijk[1]], cellSizes[2][ijk[2]]));
+	    float speed = std::max(length(velocity0),
+				   length(sample.sampleField(1, pos0, localStats)));
+	    const int numSteps = numSubSteps(speed, deltaT, cellSize, params.cflNumber);
+	    const float subDeltaT = deltaT/numSteps;
+
+	    for (int n = 0; n < numSteps; ++n) {
+
+	      float s0 = float(n)/numSteps;
+	      float s1 = float(n+1)/numSteps;
+	      pos1 = integrate(sample, pos0, velocity0, s0, s1, subDeltaT,
+			       params.integrator, params.tolerance, localStats);
+	      if (n+1 < numSteps) {
+		pos0 = pos1;
+		velocity0 = sample(pos1, s1, localStats);
+	      }
+	    }
+	  }
+	  pos1.w = 1.0f;
+	  particles.SetPosition(p, pos1);
+	}
+      }
+
+      // velocity at the new positions and removal of particles that left
+      // the fluid, both with the batched kernels
+      batch.n = 0;
+      for (size_t p = b; p < bend; ++p) {
+	if (particles.IsAlive(p)) {
+	  float4 pos = particles.GetPosition(p);
+	  float x[3] = {pos.x, pos.y, pos.z};
+	  batch.Add(vofLocator, p, x);
+	}
+      }
+      float f[ParticleBatch::Size];
+      velocity[1].Interpolate(batch.n, batch.cells, batch.pcoords, batch.out);
+      vofField1.Gather(cellRes, batch.n, batch.cells, f);
+      localStats.numVelocitySamples += batch.n;
+
+      for (size_t k = 0; k < batch.n; ++k) {
+	const size_t p = batch.index[k];
+	particles.SetVelocity(p, make_float4(batch.result[0][k], batch.result[1][k],
+					     batch.result[2][k], 0.0f));
+	if (params.killInEmptyCells && batch.inside[k] && f[k] <= g_emf0) {
+	  particles.Kill(p);
+	}
       }
     }
+  });
+
+  stats = AdvectionStats();
+  for (int t = 0; t < threadStats.size(); ++t) {
+    stats.numParticles += threadStats[t].numParticles;
+    stats.numIterations += threadStats[t].numIterations;
+    stats.numVelocitySamples += threadStats[t].numVelocitySamples;
+    stats.numForcedSteps += threadStats[t].numForcedSteps;
   }
 }
 
 // multiprocess
+namespace
+{
+  // spreads the lower 21 bits of v to every third bit
+  unsigned long long spreadBits(unsigned int v)
+  {
+    unsigned long long x = v & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+  }
+
+  unsigned long long mortonKey(const int ijk[3])
+  {
+    return spreadBits(ijk[0]) | spreadBits(ijk[1]) << 1 | spreadBits(ijk[2]) << 2;
+  }
+}
+
+void sortParticles(const RectilinearLocator &locator,
+		   ParticleStore &particles,
+		   const int numThreads)
+{
+  const size_t numParticles = particles.Size();
+  const float *px = particles.GetX();
+  const float *py = particles.GetY();
+  const float *pz = particles.GetZ();
+  const unsigned char *alive = particles.GetAlive();
+
+  // keys of the cells, 63 bits at most, so dead particles get the largest
+  std::vector<std::pair<unsigned long long, size_t> > keys(numParticles);
+  parallelFor(numThreads, numParticles, 4096,
+	      [&](size_t begin, size_t end, int) {
+    for (size_t p = begin; p < end; ++p) {
+      unsigned long long key = std::numeric_limits<unsigned long long>::max();
+      if (alive[p]) {
+	float x[3] = {px[p], py[p], pz[p]};
+	float pcoords[3];
+	int ijk[3];
+	locator.FindCell(x, ijk, pcoords);
+	key = mortonKey(ijk);
+      }
+      keys[p] = std::make_pair(key, p);
+    }
+  });
+
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<size_t> order(numParticles);
+  bool sorted = true;
+  for (size_t p = 0; p < numParticles; ++p) {
+    order[p] = keys[p].second;
+    sorted &= order[p] == p;
+  }
+  if (!sorted) {
+    particles.Permute(order);
+  }
+}
+
 void findGlobalExtent(std::vector<int> &allExtents, 
 		      int globalExtent[6])
 {
@@ -1390,16 +1972,29 @@ void prepareLabelsToSend(std::vector<std::vector<int> > &NeighborProcesses,
   }
 }
 
-void unifyLabelsInProcess(std::vector<std::vector<int> > &NeighborProcesses,
-			  const int myExtent[6], int cellRes[3], vtkFloatArray *labels,
-			  std::vector<std::vector<float4> > &labelsToRecv,
-			  std::vector<int> &labelOffsets, int processId,
-			  std::vector<int> &allLabels)
+void findLabelEquivalences(std::vector<std::vector<int> > &NeighborProcesses,
+			   const int myExtent[6], int cellRes[3],
+			   vtkFloatArray *labels,
+			   std::vector<std::vector<float4> > &labelsToRecv,
+			   std::vector<int> &neighbors,
+			   std::vector<std::vector<LabelPair> > &pairs)
 {
   const int NUM_SIDES = 6;
+  neighbors.clear();
+  for (int i = 0; i < NUM_SIDES; ++i) {
+    neighbors.insert(neighbors.end(), NeighborProcesses[i].begin(),
+		     NeighborProcesses[i].end());
+  }
+  std::sort(neighbors.begin(), neighbors.end());
+  neighbors.erase(std::unique(neighbors.begin(), neighbors.end()),
+		  neighbors.end());
+  pairs.assign(neighbors.size(), std::vector<LabelPair>());
+
   int nidx = 0;
   for (int i = 0; i < NUM_SIDES; ++i) {
     for (int j = 0; j < NeighborProcesses[i].size(); ++j) {
+      const int n = std::lower_bound(neighbors.begin(), neighbors.end(),
+				     NeighborProcesses[i][j]) - neighbors.begin();
       for (int s = 0; s < labelsToRecv[nidx].size(); ++s) {
 
 	int x = labelsToRecv[nidx][s].x;
@@ -1415,59 +2010,197 @@ void unifyLabelsInProcess(std::vector<std::vector<int> > &NeighborProcesses,
 	  z -= myExtent[4];
 
 	  int idx = x + y*cellRes[0] + z*cellRes[0]*cellRes[1];
-	  int myLabel = labels->GetValue(idx) + labelOffsets[processId];
-
-	  int neighborLabel = labelsToRecv[nidx][s].w + labelOffsets[NeighborProcesses[i][j]];
-
 	  if (labels->GetValue(idx) > -1) {
-	    if (!uf_find(allLabels, myLabel, neighborLabel)) {
-	      uf_unite(allLabels, myLabel, neighborLabel);
-	    }
+	    LabelPair pair = {int(labels->GetValue(idx)),
+			      int(labelsToRecv[nidx][s].w)};
+	    pairs[n].push_back(pair);
 	  }
 	}
       }
       ++nidx;
     }
   }
+  for (int n = 0; n < pairs.size(); ++n) {
+    std::sort(pairs[n].begin(), pairs[n].end());
+    pairs[n].erase(std::unique(pairs[n].begin(), pairs[n].end()),
+		   pairs[n].end());
+  }
 }
 
-void unifyLabelsInDomain(std::vector<int> &allLabelUnions, int numAllLabels,
-			 std::vector<int> &allLabels, vtkFloatArray *labels,
-			 std::vector<int> &labelOffsets, int processId)
+namespace
 {
-  for (int i = 0; i < allLabelUnions.size(); ++i) {
+  // sends toSend[n] to neighbors[n] and receives toRecv[n] from it
+  template<typename T>
+  void exchangeWithNeighbors(vtkMPIController *controller,
+			     const std::vector<int> &neighbors,
+			     const std::vector<std::vector<T> > &toSend,
+			     std::vector<std::vector<T> > &toRecv,
+			     const int tag)
+  {
+    const int numNeighbors = neighbors.size();
+    std::vector<int> numToSend(numNeighbors);
+    std::vector<int> numToRecv(numNeighbors);
+    std::vector<vtkMPICommunicator::Request> reqs(2*numNeighbors);
+    for (int n = 0; n < numNeighbors; ++n) {
+      numToSend[n] = toSend[n].size();
+      controller->NoBlockSend(&numToSend[n], 1, neighbors[n], tag, reqs[n]);
+      controller->NoBlockReceive(&numToRecv[n], 1, neighbors[n], tag,
+				 reqs[numNeighbors+n]);
+    }
+    controller->WaitAll(2*numNeighbors, &reqs[0]);
+
+    std::vector<vtkMPICommunicator::Request> dataReqs(2*numNeighbors);
+    toRecv.resize(numNeighbors);
+    int numReqs = 0;
+    for (int n = 0; n < numNeighbors; ++n) {
+      toRecv[n].resize(numToRecv[n]);
+      if (numToSend[n] > 0) {
+	controller->NoBlockSend((char*)&toSend[n][0], numToSend[n]*sizeof(T),
+				neighbors[n], tag+1, dataReqs[numReqs++]);
+      }
+      if (numToRecv[n] > 0) {
+	controller->NoBlockReceive((char*)&toRecv[n][0], numToRecv[n]*sizeof(T),
+				   neighbors[n], tag+1, dataReqs[numReqs++]);
+      }
+    }
+    if (numReqs > 0) {
+      controller->WaitAll(numReqs, &dataReqs[0]);
+    }
+  }
 
-    int labelId = i%numAllLabels;
-    if (allLabelUnions[i] != labelId) {
-      if (!uf_find(allLabels, allLabelUnions[i], labelId)) {
-	uf_unite(allLabels, allLabelUnions[i], labelId);
+  // sum of value over the processes before this one, in log2(P) rounds
+  long long exclusiveScan(vtkMPIController *controller, const long long value,
+			  const int tag)
+  {
+    const int numProcesses = controller->GetNumberOfProcesses();
+    const int processId = controller->GetLocalProcessId();
+    long long inclusive = value;
+    for (int d = 1; d < numProcesses; d *= 2) {
+      long long partial = inclusive;
+      vtkMPICommunicator::Request req;
+      if (processId+d < numProcesses) {
+	controller->NoBlockSend((char*)&partial, sizeof(partial),
+				processId+d, tag, req);
+      }
+      if (processId-d >= 0) {
+	long long received = 0;
+	controller->Receive((char*)&received, sizeof(received),
+			    processId-d, tag);
+	inclusive += received;
+      }
+      if (processId+d < numProcesses) {
+	req.Wait();
       }
     }
+    return inclusive - value;
   }
 
-  for (int i = 0; i < allLabels.size(); ++i) {
-    if (allLabels[i] != i) {
-      int rootId = uf_root(allLabels, i);
-      allLabels[i] = rootId;
+  // sets values[l] of every label l to the minimum over the labels it is
+  // connected to through the pairs, on all processes; returns the number
+  // of rounds. A round sends only the values that changed in the last one
+  int propagateMinimum(vtkMPIController *controller,
+		       const std::vector<int> &neighbors,
+		       const std::vector<std::vector<LabelPair> > &pairs,
+		       std::vector<long long> &values,
+		       const int tag)
+  {
+    std::vector<char> changed(values.size(), 1);
+    std::vector<std::vector<long long> > toSend(neighbors.size());
+    std::vector<std::vector<long long> > toRecv;
+    int numRounds = 0;
+    int anyChanged = 1;
+    while (anyChanged) {
+      ++numRounds;
+      for (int n = 0; n < neighbors.size(); ++n) {
+	toSend[n].clear();
+	for (int p = 0; p < pairs[n].size(); ++p) {
+	  if (changed[pairs[n][p].mine]) {
+	    toSend[n].push_back(pairs[n][p].theirs);
+	    toSend[n].push_back(values[pairs[n][p].mine]);
+	  }
+	}
+      }
+      exchangeWithNeighbors(controller, neighbors, toSend, toRecv, tag);
+
+      std::fill(changed.begin(), changed.end(), 0);
+      int myChanged = 0;
+      for (int n = 0; n < toRecv.size(); ++n) {
+	for (int p = 0; p+1 < toRecv[n].size(); p += 2) {
+	  const int label = toRecv[n][p];
+	  if (toRecv[n][p+1] < values[label]) {
+	    values[label] = toRecv[n][p+1];
+	    changed[label] = 1;
+	    myChanged = 1;
+	  }
+	}
+      }
+      anyChanged = myChanged;
+      controller->AllReduce(&myChanged, &anyChanged, 1, vtkCommunicator::MAX_OP);
     }
+    return numRounds;
   }
-  std::map<int,int> labelMap;
-  int labelId = 0;
-  for (int i = 0; i < allLabels.size(); ++i) {
-    if (labelMap.find(allLabels[i]) == labelMap.end()) {
-      labelMap[allLabels[i]] = labelId;
-      ++labelId;
+}
+
+int unifyLabelsAcrossProcesses(vtkMPIController *controller,
+			       const std::vector<int> &neighbors,
+			       std::vector<std::vector<LabelPair> > &pairs,
+			       const int numMyLabels, vtkFloatArray *labels)
+{
+  // the labels of the neighbors are exchanged with the tags 100+processId,
+  // the tags of the unification lie above them
+  const int tag = 100 + controller->GetNumberOfProcesses();
+
+  // the pairs of both sides of a face, so that values flow both ways
+  std::vector<std::vector<LabelPair> > pairsToRecv;
+  exchangeWithNeighbors(controller, neighbors, pairs, pairsToRecv, tag);
+  for (int n = 0; n < neighbors.size(); ++n) {
+    for (int p = 0; p < pairsToRecv[n].size(); ++p) {
+      LabelPair pair = {pairsToRecv[n][p].theirs, pairsToRecv[n][p].mine};
+      pairs[n].push_back(pair);
+    }
+    std::sort(pairs[n].begin(), pairs[n].end());
+    pairs[n].erase(std::unique(pairs[n].begin(), pairs[n].end()),
+		   pairs[n].end());
+  }
+
+  // 64-bit global ids (process, label); the smallest id of a component is
+  // its root
+  const long long processId = controller->GetLocalProcessId();
+  std::vector<long long> ids(numMyLabels);
+  for (int l = 0; l < numMyLabels; ++l) {
+    ids[l] = (processId << 32) | l;
+  }
+  int numRounds = propagateMinimum(controller, neighbors, pairs, ids, tag+2);
+
+  // the roots are numbered in the order of their ids, which keeps the
+  // numbering of a single process; every other label gets the number of
+  // its root by propagating it like the ids
+  long long numRoots = 0;
+  for (int l = 0; l < numMyLabels; ++l) {
+    numRoots += ids[l] == ((processId << 32) | l);
+  }
+  long long numAllRoots = numRoots;
+  controller->AllReduce(&numRoots, &numAllRoots, 1, vtkCommunicator::SUM_OP);
+  if (numAllRoots > g_maxNumLabels) {
+    return -1;
+  }
+  long long rootId = exclusiveScan(controller, numRoots, tag+4);
+  std::vector<long long> unified(numMyLabels,
+				 std::numeric_limits<long long>::max());
+  for (int l = 0; l < numMyLabels; ++l) {
+    if (ids[l] == ((processId << 32) | l)) {
+      unified[l] = rootId++;
     }
   }
+  numRounds += propagateMinimum(controller, neighbors, pairs, unified, tag+2);
 
   float *labels_ptr = labels->GetPointer(0);
   for (int i = 0; i < labels->GetNumberOfTuples(); ++i) {
     if (labels_ptr[i] > -1) {
-      int label = labels_ptr[i] + labelOffsets[processId];
-      label = allLabels[label];
-      labels_ptr[i] = labelMap[label];
+      labels_ptr[i] = unified[int(labels_ptr[i])];
     }
   }
+  return numRounds;
 }
 
 void calcLabelPoints(vtkFloatArray *labels,
@@ -1529,6 +2262,9 @@ void calcLabelBounds(vtkPoints *points,
     if (labelBoundsTmp[pointLabel][5] < p[2]) labelBoundsTmp[pointLabel][5] = p[2];	
   }
 
+  RectilinearLocator locator;
+  buildLocator(grid, locator);
+
   for (int i = 0; i < numLabels; ++i) {
     
     double x0[3] = {labelBoundsTmp[i][0], labelBoundsTmp[i][2], labelBoundsTmp[i][4]};
@@ -1537,8 +2273,8 @@ void calcLabelBounds(vtkPoints *points,
     int ijk1[3];
     double pcoords[3];
     
-    grid->ComputeStructuredCoordinates(x0, ijk0, pcoords);
-    grid->ComputeStructuredCoordinates(x1, ijk1, pcoords);
+    locator.FindCell(x0, ijk0, pcoords);
+    locator.FindCell(x1, ijk1, pcoords);
 
     labelBounds[i] = {ijk0[0],ijk1[0],
 		      ijk0[1],ijk1[1],
@@ -1550,7 +2286,8 @@ void generateBoundaries(vtkPoints *points,
 			vtkFloatArray *labels,
 			vtkRectilinearGrid *grid,			
 			vtkPolyData *boundaries,
-			const int refinement)
+			const int refinement,
+			const float isoValue)
 {
   if (points->GetNumberOfPoints() == 0) {
     return;
@@ -1570,7 +2307,6 @@ void generateBoundaries(vtkPoints *points,
   std::vector<std::array<int,6>> labelBounds(numLabels);
   calcLabelBounds(points, labels, grid, labelBounds);
   
-  const float isoValue = 0.501f;
   int vertexID = 0;
   std::vector<unsigned int> indices(0);
   std::vector<float4> vertices(0);
@@ -1624,12 +2360,10 @@ void generateBoundaries(vtkPoints *points,
 			     coords[n]->GetComponent(ijk1[n]+1,0)); 
     }
     
-    vtkRectilinearGrid *subGrid = vtkRectilinearGrid::New();    
-    subGrid->SetDimensions(subNodeRes[0],subNodeRes[1],subNodeRes[2]);
-
-    subGrid->SetXCoordinates(subcoords[0]);
-    subGrid->SetYCoordinates(subcoords[1]);
-    subGrid->SetZCoordinates(subcoords[2]);
+    RectilinearLocator subLocator;
+    subLocator.SetCoordinates(subcoords[0]->GetPointer(0),
+			      subcoords[1]->GetPointer(0),
+			      subcoords[2]->GetPointer(0), subNodeRes);
 
     const int numElements = subNodeRes[0]*subNodeRes[1]*subNodeRes[2];
     std::vector<float> field(numElements, 0.0f);
@@ -1640,7 +2374,7 @@ void generateBoundaries(vtkPoints *points,
       points->GetPoint(labelPoints[i][j], x);
       int ijk[3];
       double pcoords[3];    
-      subGrid->ComputeStructuredCoordinates(x, ijk, pcoords);
+      subLocator.FindCell(x, ijk, pcoords);
 
       int ids[8] =
 	{ijk[0]   +  ijk[1]*subNodeRes[0]    +  ijk[2]*subNodeRes[0]*subNodeRes[1],
@@ -1662,9 +2396,7 @@ void generateBoundaries(vtkPoints *points,
       field[ids[7]] += (1.0f-pcoords[0])*(     pcoords[1])*(     pcoords[2]);
     }
 
-    extractSurface(field.data(), subNodeRes, subcoords, 0.501f, indices, vertices, vertexID);    
-
-    subGrid->Delete();
+    extractSurface(field.data(), subNodeRes, subcoords, isoValue, indices, vertices, vertexID);    
 
     labelOffsets[i+1] = vertices.size();
   }
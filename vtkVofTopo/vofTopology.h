@@ -12,10 +12,21 @@
 #include <algorithm>
 #include <map>
 #include "helper_math.h"
+#include "rectilinearLocator.h"
+#include "componentLabeling.h"
+#include "interfaceIndex.h"
+#include "brickedVolume.h"
+#include "particleStore.h"
+#include "velocityCache.h"
 
 int findClosestTimeStep(double requestedTimeValue,
 			const std::vector<double>& timeSteps);
 
+// cell locator for the coordinates of a rectilinear grid, replaces
+// vtkRectilinearGrid::ComputeStructuredCoordinates in the particle loops
+void buildLocator(vtkRectilinearGrid *grid, RectilinearLocator &locator);
+void buildLocator(vtkDataArray *coords[3], RectilinearLocator &locator);
+
 
 void generateSeedPoints(vtkRectilinearGrid *input,
 			int refinement,
@@ -23,23 +34,100 @@ void generateSeedPoints(vtkRectilinearGrid *input,
 			vtkIntArray *connectivity,
 			vtkShortArray *coords);
 
+// seeds of the liquid cells of mask, with PLIC planes in the cells of
+// interfaceIndex; the volume fractions are read from vofBricks if input has
+// no "Data" array
 void generateSeedPointsPLIC(vtkRectilinearGrid *input,
 			    int refinement,
 			    vtkPoints *points,
 			    vtkIntArray *connectivity,
 			    vtkShortArray *coords,
 			    int globalExtent[6],
-			    int numGhostLevels);
-
-void initVelocities(vtkRectilinearGrid *velocity,
-		    std::vector<float4> &particles,
-		    std::vector<float4> &velocities);
-
+			    int numGhostLevels,
+			    const OccupancyMask &mask,
+			    const InterfaceIndex &interfaceIndex,
+			    const BrickedVolume *vofBricks,
+			    const int numThreads);
+
+// replaces the volume fraction array "Data" of vofGrid with a signed char
+// array holding f*127; empty and full cells stay exactly 0 and 127, so only
+// the values inside interface cells are rounded
+void compressVof(vtkRectilinearGrid *vofGrid);
+
+// empty, interface and full cells of the volume fraction array "Data" of
+// vofGrid by the thresholds g_emf0 and g_emf1
+void buildOccupancyMask(vtkRectilinearGrid *vofGrid, OccupancyMask &mask,
+			const int numThreads);
+
+// bricks of the volume fraction array "Data" of vofGrid, with the empty
+// and full bricks by the thresholds g_emf0 and g_emf1
+void buildBrickedVolume(vtkRectilinearGrid *vofGrid, BrickedVolume &bricks,
+			const int numThreads);
+
+// particle integrators used by advectParticles
+enum {
+  INTEGRATOR_TRAPEZOIDAL = 0,           // 20 fixed point iterations
+  INTEGRATOR_TRAPEZOIDAL_CONVERGED = 1, // fixed point iterations until converged
+  INTEGRATOR_RK2 = 2,                   // Heun
+  INTEGRATOR_RK4 = 3,
+  INTEGRATOR_RK45 = 4                   // adaptive Cash-Karp
+};
+
+// work done in one call to advectParticles
+struct AdvectionStats
+{
+  long long numParticles;       // alive particles
+  long long numIterations;      // fixed point iterations or RK (sub)steps
+  long long numVelocitySamples; // interpolations of the velocity field
+  // RK45 integrations that ran out of sub-steps and covered the rest of
+  // the interval in one step without error control
+  long long numForcedSteps;
+
+  AdvectionStats() : numParticles(0), numIterations(0), numVelocitySamples(0),
+		     numForcedSteps(0) {}
+};
+
+// settings of advectParticles
+struct AdvectionParams
+{
+  int integrator;            // one of INTEGRATOR_*
+  float tolerance;           // for the converged and adaptive integrators
+  int temporalInterpolation; // blend the two velocity fields in time
+  float cflNumber;           // max cells per sub-step when blending
+  int numThreads;            // <= 0 uses all hardware threads
+  int killInEmptyCells;      // particles that end in an empty cell die
+
+  AdvectionParams() : integrator(INTEGRATOR_TRAPEZOIDAL), tolerance(0.0f),
+		      temporalInterpolation(0), cflNumber(1.0f), numThreads(0),
+		      killInEmptyCells(1) {}
+};
+
+// numThreads <= 0 uses all hardware threads
+void initVelocities(const VelocityCache &velocity,
+		    ParticleStore &particles,
+		    const int numThreads);
+
+// advects particles over deltaT using the velocity at the end of the time
+// step, velocity[1]; with params.temporalInterpolation the velocity is
+// blended between velocity[0] and velocity[1] and the step is sub-cycled
+// according to params.cflNumber; dead particles are skipped. Particles in
+// empty cells die with params.killInEmptyCells; the volume fractions are
+// read from vofBricks if inputVof has no "Data" array
 void advectParticles(vtkRectilinearGrid *inputVof,
-		     vtkRectilinearGrid *inputVelocity,
-		     std::vector<float4> &particles,
-		     std::vector<float4> &velocities,
-		     const float deltaT);
+		     const BrickedVolume *vofBricks,
+		     const VelocityCache velocity[2],
+		     ParticleStore &particles,
+		     const float deltaT,
+		     const AdvectionParams &params,
+		     AdvectionStats &stats);
+
+// sorts the particles along the Z-order (Morton) curve of the cells of the
+// locator's grid they are in, so that neighboring particles read
+// neighboring velocities; dead particles go to the end, ids and processes
+// move with the particles
+void sortParticles(const RectilinearLocator &locator,
+		   ParticleStore &particles,
+		   const int numThreads);
 
 // multiprocess
 void findGlobalExtent(std::vector<int> &allExtents, 
@@ -108,88 +196,16 @@ void sendData(const std::vector<std::vector<T> > &dataToSend, std::vector<T> &da
 // components
 static const double g_emf0 = 0.000001;
 static const double g_emf1 = 0.999999;
-static int g_res[3];
-static int g_labelId = 0;
-
-template<typename T>
-static void grow(std::vector<T> &data, const int &idx,
-		 std::vector<float> &labels)
-{
-  T tmp = data[idx];
-
-  if (tmp <= g_emf0) {
-    return;
-  }
-
-  labels[idx] = g_labelId;
-  data[idx] = 0.0;
-
-  int i = idx%g_res[0];
-  int j = (idx/g_res[0])%g_res[1];
-  int k = idx/(g_res[0]*g_res[1]);
-
-  if (i + 1 < g_res[0]) {
-    grow(data, idx+1, labels);
-  }
-  if (i > 0) {
-    grow(data, idx-1, labels);
-  }
-  if (j + 1 < g_res[1]) {
-    grow(data, idx+g_res[0], labels);
-  }
-  if (j > 0) {
-    grow(data, idx-g_res[0], labels);
-  }
-  if (k + 1 < g_res[2]) {
-    grow(data, idx+g_res[0]*g_res[1], labels);
-  }
-  if (k > 0) {
-    grow(data, idx-g_res[0]*g_res[1], labels);
-  }
-}
-
-template<typename T>
-static bool extractComponents_pred(T f)
-{
-  return f > g_emf0;
-}
-
-template<typename T>
-static void extractComponents(const T *vofField,
-			      const int res[3],
-			      float *labelField)
+// labels are kept in float arrays, which hold integers exactly up to 2^24
+static const int g_maxNumLabels = 1 << 24;
+
+// labels of the liquid cells of mask, numbered from 0; returns the number
+// of labels, see labelComponents
+inline int extractComponents(const OccupancyMask &mask,
+			     float *labelField,
+			     const int numThreads)
 {
-  g_res[0] = res[0];
-  g_res[1] = res[1];
-  g_res[2] = res[2];
-
-  int numCells = res[0]*res[1]*res[2];
-  std::vector<T> fieldTmp(vofField, vofField+numCells);
-  std::vector<float> labelFieldTmp(numCells, -1.0f);
-
-  int i = 0;
-  while (i < numCells) {
-
-    typename std::vector<T>::iterator it =
-      std::find_if(fieldTmp.begin()+i, fieldTmp.end(),
-		   extractComponents_pred<T>);
-
-    if (it == fieldTmp.end()) {
-      break;
-    }
-
-    int idx = it - fieldTmp.begin();
-
-    if (idx > i) {
-      i = idx;
-    }
-    else {
-      ++i;
-    }
-    grow(fieldTmp, idx, labelFieldTmp);
-    ++g_labelId;
-  }
-  std::copy(labelFieldTmp.begin(), labelFieldTmp.end(), labelField);
+  return labelComponents(mask, numThreads, labelField);
 }
 
 void prepareLabelsToSend(std::vector<std::vector<int> > &NeighborProcesses,
@@ -197,15 +213,42 @@ void prepareLabelsToSend(std::vector<std::vector<int> > &NeighborProcesses,
 			 int cellRes[3], vtkFloatArray *labels,
 			 std::vector<std::vector<float4> > &labelsToSend, int numGhosts);
 
-void unifyLabelsInProcess(std::vector<std::vector<int> > &NeighborProcesses,
-			  const int myExtent[6], int cellRes[3], vtkFloatArray *labels,
-			  std::vector<std::vector<float4> > &labelsToRecv,
-			  std::vector<int> &labelOffsets, int processId,
-			  std::vector<int> &allLabels);
+// a label of this process that touches a label of a neighbor process
+struct LabelPair
+{
+  int mine;
+  int theirs;
 
-void unifyLabelsInDomain(std::vector<int> &allLabelUnions, int numAllLabels,
-			 std::vector<int> &allLabels, vtkFloatArray *labels,
-			 std::vector<int> &labelOffsets, int processId);
+  bool operator<(const LabelPair &b) const
+  {
+    return mine < b.mine || (mine == b.mine && theirs < b.theirs);
+  }
+  bool operator==(const LabelPair &b) const
+  {
+    return mine == b.mine && theirs == b.theirs;
+  }
+};
+
+// the distinct neighbor processes and, for each, the distinct pairs of
+// labels of the received cells that lie in myExtent
+void findLabelEquivalences(std::vector<std::vector<int> > &NeighborProcesses,
+			   const int myExtent[6], int cellRes[3],
+			   vtkFloatArray *labels,
+			   std::vector<std::vector<float4> > &labelsToRecv,
+			   std::vector<int> &neighbors,
+			   std::vector<std::vector<LabelPair> > &pairs);
+
+// replaces the local labels by labels of the whole domain, numbered from 0
+// in the order of the first process and local label of each component.
+// Only neighbor processes exchange labels: the smallest global id of each
+// component spreads over the pairs in rounds until no process changes, so
+// memory does not grow with the number of processes or labels elsewhere.
+// Returns the number of rounds, or -1 on all processes if there are more
+// than g_maxNumLabels components; the labels stay local then
+int unifyLabelsAcrossProcesses(vtkMPIController *controller,
+			       const std::vector<int> &neighbors,
+			       std::vector<std::vector<LabelPair> > &pairs,
+			       const int numMyLabels, vtkFloatArray *labels);
 
 void generateBoundaries(vtkPoints *points,
 			vtkFloatArray *labels,
@@ -217,7 +260,8 @@ void generateBoundaries(vtkPoints *points,
 			vtkFloatArray *labels,
 			vtkRectilinearGrid *grid,			
 			vtkPolyData *boundaries,
-			const int refinement);
+			const int refinement,
+			const float isoValue);
 
 void smoothSurface(std::vector<float3>& vertices,
 		   std::vector<int>& indices);
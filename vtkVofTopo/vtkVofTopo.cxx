@@ -1,5 +1,6 @@
 #include "vtkVofTopo.h"
 #include "vofTopology.h"
+#include "checkpointFile.h"
 
 #include "vtkSmartPointer.h"
 #include "vtkObjectFactory.h"
@@ -10,6 +11,7 @@
 #include "vtkCellArray.h"
 #include "vtkFloatArray.h"
 #include "vtkDoubleArray.h"
+#include "vtkSignedCharArray.h"
 #include "vtkPoints.h"
 #include "vtkPointData.h"
 #include "vtkCellData.h"
@@ -17,42 +19,97 @@
 #include "vtkMPICommunicator.h"
 #include "vtkPolyData.h"
 #include "vtkMultiBlockDataSet.h"
+#include "vtkCompositeDataSet.h"
+#include "vtkFieldData.h"
 #include "vtkConnectivityFilter.h"
 #include "vtkUnstructuredGrid.h"
 #include "vtkDataSetSurfaceFilter.h"
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <limits>
+#include <algorithm>
 #include <map>
 #include <set>
+#include <chrono>
+#include <sstream>
 
 vtkStandardNewMacro(vtkVofTopo);
 
 
 //----------------------------------------------------------------------------
 vtkVofTopo::vtkVofTopo() :
-  LastLoadedTimestep(-1),
-  UseCache(false),
+  TimestepT0(-1),
+  TimestepT1(-1),
   IterType(ITERATE_OVER_TARGET),
   ComputeComponentLabels(1),
-  Seeds(0),
   Incr(1.0),
-  TimestepT0(-1),
-  TimestepT1(-1),
-  NumGhostLevels(4)
+  TimeStepStride(1),
+  RegionOfInterest(0),
+  RegionOfInterestMargin(2.0),
+  RegionRequested(false),
+  HasPieceExtent(false),
+  NumGhostLevels(4),
+  HasGlobalContext(false),
+  NumLabelRounds(0),
+  Seeds(0),
+  NumThreads(0),
+  Integrator(INTEGRATOR_TRAPEZOIDAL),
+  IntegrationTolerance(1e-5),
+  TemporalInterpolation(0),
+  CFLNumber(1.0),
+  CompactInterval(1),
+  SortInterval(0),
+  NumAdvectionSteps(0),
+  AsyncAdvection(0),
+  AdvectionPending(false),
+  AdvectionTime(0.0),
+  StallTime(0.0),
+  AdvectedTimestep(-1),
+  CheckpointInterval(0),
+  CheckpointBudget(1024),
+  CheckpointSignature(0),
+  CheckpointDirectory(0),
+  DatasetHash(0),
+  ComponentCacheBudget(256),
+  ReuseParticles(false),
+  BoundaryIsoValue(0.501),
+  TargetStride(0),
+  FlowMapRefinement(0),
+  FlowMapBudget(1024),
+  FlowMapSettingsHash(0),
+  FlowMapStep(-1),
+  LabelingMode(LABELING_FORWARD),
+  BackwardTimestep(-1),
+  BackwardPrevTimestep(-1),
+  HasBackwardLabels(false),
+  AdaptiveRefinement(0),
+  RefinementLevel(-1),
+  NumAdaptiveParticles(0),
+  UseCache(false),
+  LastLoadedTimestep(-1),
+  CompressVof(0),
+  BrickVof(0),
+  VelocityPrecision(VELOCITY_FLOAT32)
 {
   this->SetNumberOfInputPorts(2);
   this->Controller = vtkMPIController::New();
   this->Boundaries = vtkPolyData::New();
   this->VofGrid[0] = vtkRectilinearGrid::New();
   this->VofGrid[1] = vtkRectilinearGrid::New();
-  this->VelocityGrid[0] = vtkRectilinearGrid::New();
-  this->VelocityGrid[1] = vtkRectilinearGrid::New();
+  this->InitVofGrid = vtkRectilinearGrid::New();
+  for (int a = 0; a < NUM_INPUT_ARRAYS; ++a) {
+    LastInputMTimes[a] = 0;
+    LastInputShared[a] = false;
+  }
+  CopiedVofBytes = 0;
 }
 
 //----------------------------------------------------------------------------
 vtkVofTopo::~vtkVofTopo()
 {
+  WaitForAdvection();
+  SetCheckpointDirectory(0);
   if (Seeds != 0) {
     Seeds->Delete();
   }
@@ -60,8 +117,7 @@ vtkVofTopo::~vtkVofTopo()
   this->Boundaries->Delete();
   this->VofGrid[0]->Delete();
   this->VofGrid[1]->Delete();
-  this->VelocityGrid[0]->Delete();
-  this->VelocityGrid[1]->Delete();
+  this->InitVofGrid->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -92,6 +148,18 @@ int vtkVofTopo::RequestInformation(vtkInformation *vtkNotUsed(request),
     inInfo->Get(vtkStreamingDemandDrivenPipeline::TIME_STEPS(),
 		&this->InputTimeValues[0]);
 
+    // identifies the data set in checkpoint files
+    DatasetHash = hashBytes(&InputTimeValues[0],
+			    InputTimeValues.size()*sizeof(double));
+    for (int i = 0; i < GetNumberOfInputPorts(); ++i) {
+      vtkInformation *info = inputVector[i]->GetInformationObject(0);
+      int wholeExtent[6] = {0,0,0,0,0,0};
+      if (info->Has(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT())) {
+	info->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+      }
+      DatasetHash = hashBytes(wholeExtent, sizeof(wholeExtent), DatasetHash);
+    }
+
     if (InputTimeValues.size() > 1 &&
 	InputTimeValues[0] > InputTimeValues[1]) {
       Incr = -1.0;
@@ -137,23 +205,65 @@ int vtkVofTopo::RequestUpdateExtent(vtkInformation *vtkNotUsed(request),
   vtkInformation *outInfo = outputVector->GetInformationObject(0);
   outInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_NUMBER_OF_GHOST_LEVELS(), NumGhostLevels);
 
-  if(TimestepT0 == TimestepT1) {
+  if (UseFlowMaps()) {
+    if (FlowMapStep < 0) {
+      InitTimeStep = std::min(GetRequestedTimestep(outInfo), TargetTimeStep);
+      ScheduleFlowMaps();
+      FlowMapStep = 0;
+    }
+    for (int i = 0; i < numInputs; i++) {
+      vtkInformation *inInfo = inputVector[i]->GetInformationObject(0);
+      inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_TIME_STEP(),
+		  InputTimeValues[FlowMapSchedule[FlowMapStep]]);
+    }
+    return 1;
+  }
 
-    double targetTime = outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_TIME_STEP());
-    if(targetTime > InputTimeValues.back()) {
-      targetTime = InputTimeValues.back();
+  // a backward sweep runs before the forward advection starts
+  if(TimestepT0 == TimestepT1 && BackwardTimestep < 0) {
+
+    if (IterType == ITERATE_OVER_INIT) {
+      // the time slider moves the initial time step; particles of all
+      // processes are advected again, flow maps cannot cross processes
+      int initTimeStep = std::min(GetRequestedTimestep(outInfo), TargetTimeStep);
+      if (initTimeStep != InitTimeStep) {
+	InitTimeStep = initTimeStep;
+	LastLoadedTimestep = -1;
+	Checkpoints.Clear();
+      }
+    }
+    else {
+      TargetTimeStep = GetRequestedTimestep(outInfo);
     }
-    TargetTimeStep = findClosestTimeStep(targetTime, InputTimeValues);
 
-    if (TargetTimeStep < 0) {
-      TargetTimeStep = 0;
+    // the particles are kept while the advection settings and inputs are
+    // the same
+    const unsigned long long advectionSignature =
+      GetStageSignature(StageTracker::ADVECTION);
+    const bool advected =
+      Stages.IsCurrent(StageTracker::ADVECTION, advectionSignature);
+
+    int reuse = advected && ParticlesResumable() && !IsBatchMode() &&
+      LastLoadedTimestep == TargetTimeStep && TimestepT1 == TargetTimeStep;
+    if (Controller->GetCommunicator() != 0) {
+      int allReuse = reuse;
+      Controller->AllReduce(&reuse, &allReuse, 1, vtkCommunicator::MIN_OP);
+      reuse = allReuse;
     }
-    if (TargetTimeStep > InputTimeValues.size()-1) {
-      TargetTimeStep = InputTimeValues.size()-1;
+    ReuseParticles = reuse;
+    if (ReuseParticles) {
+      for (int i = 0; i < numInputs; i++) {
+	vtkInformation *inInfo = inputVector[i]->GetInformationObject(0);
+	inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_TIME_STEP(),
+		    InputTimeValues[TargetTimeStep]);
+      }
+      return 1;
     }
 
     if (LastLoadedTimestep > -1 &&
-    	LastLoadedTimestep < TargetTimeStep) {
+	LastLoadedTimestep < TargetTimeStep &&
+	advected && ParticlesResumable() &&
+	!MissesTargetResults(LastLoadedTimestep)) {
       UseCache = true;
     }
     else {
@@ -161,17 +271,55 @@ int vtkVofTopo::RequestUpdateExtent(vtkInformation *vtkNotUsed(request),
       LastLoadedTimestep = -1;
     }
 
+    if (CheckpointInterval > 0 && ParticlesResumable()) {
+      ResumeFromCheckpoint();
+    }
+
+    if (!UseCache || !advected) {
+      Stages.Record(StageTracker::ADVECTION, advectionSignature);
+    }
+    vtkDebugMacro(<< StageTracker::Describe(StageTracker::ADVECTION, true));
+
     if (UseCache) {
-      ++TimestepT1;
+      // results of the batch mode after the resumed state are recomputed
+      TargetResults.erase(TargetResults.upper_bound(TimestepT1),
+			  TargetResults.end());
+      TimestepT1 = NextTimestep(TimestepT1);
     }
     else {
+      TargetResults.clear();
       TimestepT0 = TimestepT1 = InitTimeStep;
+      if (UseAdaptiveRefinement() && RefinementLevel < 0) {
+	RefinementLevel = 0;
+      }
+      else if (AdaptiveRefinement && Refinement > 0 && !ComputeComponentLabels) {
+	vtkWarningMacro(<<"Adaptive refinement needs the component labels, "
+			<< "advecting all seeds");
+      }
+      if (LabelingMode == LABELING_BACKWARD && !HasBackwardLabels &&
+	  InitTimeStep < TargetTimeStep) {
+	BackwardTimestep = TargetTimeStep;
+      }
+    }
+  }
+  if (BackwardTimestep >= 0) {
+    for (int i = 0; i < numInputs; i++) {
+      vtkInformation *inInfo = inputVector[i]->GetInformationObject(0);
+      inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_TIME_STEP(),
+		  InputTimeValues[BackwardTimestep]);
     }
+    return 1;
   }
   if (TimestepT1 <= TargetTimeStep) {
     
     int numInputs = this->GetNumberOfInputPorts();
 
+    int extent[6];
+    RegionRequested = GetRegionOfInterest(extent);
+    if (RegionOfInterest && HasPieceExtent && !RegionRequested) {
+      std::copy(PieceExtent, PieceExtent+6, extent);
+    }
+
     for (int i = 0; i < numInputs; i++) {
       vtkInformation *inInfo = inputVector[i]->GetInformationObject(0);
 
@@ -180,6 +328,9 @@ int vtkVofTopo::RequestUpdateExtent(vtkInformation *vtkNotUsed(request),
 		    InputTimeValues[TimestepT1]);
 	LastLoadedTimestep = TimestepT1;
       }
+      if (RegionOfInterest && HasPieceExtent) {
+	inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(), extent, 6);
+      }
     }
   }    
   return 1;
@@ -190,6 +341,16 @@ int vtkVofTopo::RequestData(vtkInformation *request,
 			    vtkInformationVector **inputVector,
 			    vtkInformationVector *outputVector)
 {
+  if (UseFlowMaps()) {
+    return RequestFlowMapData(request, inputVector, outputVector);
+  }
+  if (BackwardTimestep >= 0) {
+    return RequestBackwardData(request, inputVector, outputVector);
+  }
+  if (ReuseParticles) {
+    return RequestReusedData(request, inputVector, outputVector);
+  }
+
   std::cout << "TimestepT0 = " << TimestepT0 << std::endl;
   vtkInformation *inInfoVelocity = inputVector[0]->GetInformationObject(0);
   vtkInformation *inInfoVof = inputVector[1]->GetInformationObject(0);
@@ -198,97 +359,106 @@ int vtkVofTopo::RequestData(vtkInformation *request,
   vtkMultiBlockDataSet *output =
     vtkMultiBlockDataSet::SafeDownCast(outInfo->Get(vtkDataObject::DATA_OBJECT()));
 
-  if (TimestepT0 == TimestepT1 && Controller->GetCommunicator() != 0) {
+  // a run resumed from a checkpoint file starts with TimestepT0 != TimestepT1
+  if ((TimestepT0 == TimestepT1 || !HasGlobalContext) &&
+      Controller->GetCommunicator() != 0) {
     // find neighbor processes and global domain bounds
     GetGlobalContext(inInfoVof);
   }
 
-  if (TimestepT0 == TimestepT1) { // first time step
-    VofGrid[1]->DeepCopy(vtkRectilinearGrid::
-			 SafeDownCast(inInfoVof->Get(vtkDataObject::DATA_OBJECT())));
-    VelocityGrid[1]->DeepCopy(vtkRectilinearGrid::
-			      SafeDownCast(inInfoVelocity->Get(vtkDataObject::DATA_OBJECT())));
-    VofGrid[0]->ShallowCopy(VofGrid[1]);
-    VelocityGrid[0]->ShallowCopy(VelocityGrid[1]);
+  // the previous step may still be advected in the background
+  WaitForAdvection();
+
+  // rotate the time step window
+  std::swap(VofGrid[0], VofGrid[1]);
+  std::swap(VofSummaries[0], VofSummaries[1]);
+  Velocity[0].Swap(Velocity[1]);
+
+  // the pipeline may change the input arrays while the particles are
+  // advected asynchronously, so the advection must only read copies;
+  // compressVof and the bricks replace the volume fractions by copies,
+  // unless they are compressed already
+  vtkRectilinearGrid *inputVof = vtkRectilinearGrid::
+    SafeDownCast(inInfoVof->Get(vtkDataObject::DATA_OBJECT()));
+  int index;
+  vtkDataArray *inputData = inputVof->GetCellData()->GetArray("Data", index);
+  const bool replacedData = BrickVof ||
+    (CompressVof && inputData != 0 && !inputData->IsA("vtkSignedCharArray"));
+  LoadVofTimeStep(inputVof, AsyncAdvection, AsyncAdvection && !replacedData);
+  SummarizeVofTimeStep();
+  Velocity[1].Set(vtkRectilinearGrid::
+		  SafeDownCast(inInfoVelocity->Get(vtkDataObject::DATA_OBJECT())),
+		  VelocityPrecision, NumThreads);
+  if (!RegionRequested) {
+    VofGrid[1]->GetExtent(PieceExtent);
+    buildLocator(VofGrid[1], PieceLocator);
+    HasPieceExtent = true;
   }
-  else {
+  RegionRequested = false;
+
+  vtkDebugMacro(<< "Loaded time step " << TimestepT1 << ": copied "
+		<< CopiedVofBytes << " bytes of volume fractions, converted "
+		<< Velocity[1].GetMemorySize() << " bytes of velocities");
+
+  if (TimestepT0 == TimestepT1) { // first time step
     VofGrid[0]->ShallowCopy(VofGrid[1]);
-    VelocityGrid[0]->ShallowCopy(VelocityGrid[1]);
-    
-    VofGrid[1]->DeepCopy(vtkRectilinearGrid::
-			 SafeDownCast(inInfoVof->Get(vtkDataObject::DATA_OBJECT())));
-    VelocityGrid[1]->DeepCopy(vtkRectilinearGrid::
-			      SafeDownCast(inInfoVelocity->Get(vtkDataObject::DATA_OBJECT())));
+    VofSummaries[0] = VofSummaries[1];
+    Velocity[0].Clear();
   }
   // Stage I ---------------------------------------------------------------
   if (TimestepT0 == TimestepT1) {
     if (!UseCache) {
       
-      InitParticles(VofGrid[0]);
-      InitVelocities(VelocityGrid[0]);
-
-      Boundaries->SetPoints(vtkPoints::New());
-      vtkCellArray *cells = vtkCellArray::New();
-      Boundaries->SetPolys(cells);
-      vtkFloatArray *ivertices = vtkFloatArray::New();
-      ivertices->SetName("IVertices");
-      ivertices->SetNumberOfComponents(3);
-      Boundaries->GetPointData()->AddArray(ivertices);
+      InitParticles(VofGrid[0], VofSummaries[0]);
+      InitVelocities(Velocity[1]);
+      InitBoundaries();
     }
   }
 
   // Stage II --------------------------------------------------------------  
   if (TimestepT0 != TimestepT1) {    
     if(TimestepT0 < TargetTimeStep) {      
-      AdvectParticles(VofGrid, VelocityGrid);
+      // the last step and targets of the batch mode are needed right away
+      // for the components, the particles for the next region of interest
+      bool async = AsyncAdvection && TimestepT1 < TargetTimeStep &&
+	!IsBatchTarget(TimestepT1) && !RegionOfInterest;
+      AdvectParticles(VofGrid, Velocity, async);
     }
     
     if (ComputeComponentLabels) {
       bool finishedAdvection = TimestepT1 >= TargetTimeStep;
-      if (finishedAdvection) {
-	// Stage III -----------------------------------------------------------
-	vtkSmartPointer<vtkRectilinearGrid> components = vtkSmartPointer<vtkRectilinearGrid>::New();
-	ExtractComponents(VofGrid[1], components);
-
-	// Stage IV ------------------------------------------------------------
+      bool batchTarget = IsBatchMode() &&
+	(finishedAdvection || IsBatchTarget(TimestepT1));
+      if (finishedAdvection || batchTarget) {
+	vtkSmartPointer<vtkPolyData> particles = vtkSmartPointer<vtkPolyData>::New();
+	vtkSmartPointer<vtkPolyData> boundaries = Boundaries;
+	if (!finishedAdvection) {
+	  boundaries = vtkSmartPointer<vtkPolyData>::New();
+	}
 	std::vector<float> particleLabels;
-	LabelAdvectedParticles(components, particleLabels);
-
-	// Stage V -------------------------------------------------------------
-	TransferLabelsToSeeds(particleLabels);
+	LabelSeeds(TimestepT1, particleLabels);
+	if (finishedAdvection && UseAdaptiveRefinement() &&
+	    RefineAdaptively(particleLabels)) {
+	  // the next pass advects the refined cells from InitTimeStep
+	  TimestepT0 = TimestepT1 = InitTimeStep;
+	  request->Set(vtkStreamingDemandDrivenPipeline::CONTINUE_EXECUTING(), 1);
+	  return 1;
+	}
+	BuildTopology(particleLabels, particles, boundaries);
 
-	// Transfer seed points from neighbors ---------------------------------
-	vtkPolyData *boundarySeeds = vtkPolyData::New();
-	if (Controller->GetCommunicator() != 0) {
-	  ExchangeBoundarySeedPoints(boundarySeeds);
+	if (batchTarget) {
+	  StoreTargetResult(particles, boundaries);
 	}
-	
-	// Stage VI ------------------------------------------------------------
-	GenerateBoundaries(Boundaries);
-
-	boundarySeeds->Delete();
-
-	// Generate output -----------------------------------------------------
-	vtkPolyData *particles = vtkPolyData::New();
-	vtkPoints *ppoints = vtkPoints::New();
-	vtkFloatArray *labels = vtkFloatArray::New();
-	ppoints->SetNumberOfPoints(Particles.size());
-	labels->SetName("Labels");
-	labels->SetNumberOfComponents(1);
-	labels->SetNumberOfTuples(particleLabels.size());
-	for (int i = 0; i < Particles.size(); ++i) {
-
-	  float p[3] = {Particles[i].x, Particles[i].y, Particles[i].z};
-	  ppoints->SetPoint(i, p);
-	  labels->SetValue(i, particleLabels[i]);
+	if (finishedAdvection) {
+	  ParticleLabels.swap(particleLabels);
+	  LabeledParticles = particles;
+	  Stages.Record(StageTracker::LABELS,
+			GetStageSignature(StageTracker::LABELS));
+	  Stages.Record(StageTracker::BOUNDARIES,
+			GetStageSignature(StageTracker::BOUNDARIES));
+	  output->SetBlock(1, particles);
+	  output->SetBlock(2, Boundaries);
 	}
-	particles->SetPoints(ppoints);
-	particles->GetPointData()->AddArray(labels);
-	output->SetBlock(1, particles);
-
-	output->SetBlock(2, Boundaries);
-	
-	// output->SetBlock(3, components);
       }
     }
   }
@@ -298,14 +468,391 @@ int vtkVofTopo::RequestData(vtkInformation *request,
   if (finishedAdvection) {
     request->Remove(vtkStreamingDemandDrivenPipeline::CONTINUE_EXECUTING());
     output->SetBlock(0, Seeds);
+    if (IsBatchMode()) {
+      vtkSmartPointer<vtkMultiBlockDataSet> results =
+	vtkSmartPointer<vtkMultiBlockDataSet>::New();
+      GetTargetResults(results);
+      output->SetBlock(3, results);
+    }
   }
   else {
     request->Set(vtkStreamingDemandDrivenPipeline::CONTINUE_EXECUTING(), 1);
-    ++TimestepT1;
+    TimestepT1 = NextTimestep(TimestepT1);
   }
   return 1;
 }
 
+//----------------------------------------------------------------------------
+// Restores the latest checkpoint before TargetTimeStep if it is later than
+// the current state; all processes resume from the same time step.
+// Checkpoints are dropped whenever the advection settings or inputs change
+void vtkVofTopo::ResumeFromCheckpoint()
+{
+  WaitForAdvection();
+
+  const unsigned long long signature =
+    GetStageSignature(StageTracker::ADVECTION);
+  if (CheckpointSignature != signature) {
+    Checkpoints.Clear();
+    CheckpointSignature = signature;
+  }
+  Checkpoints.SetBudget(size_t(std::max(CheckpointBudget, 0)) << 20);
+
+  const int current = UseCache ? LastLoadedTimestep : -1;
+  int checkpoint = Checkpoints.FindLatest(std::max(InitTimeStep, current+1),
+					  TargetTimeStep);
+
+  if (Controller->GetCommunicator() != 0) {
+    int latest = checkpoint;
+    Controller->AllReduce(&checkpoint, &latest, 1, vtkCommunicator::MIN_OP);
+    int found = latest >= 0 && Checkpoints.FindLatest(latest, latest+1) == latest;
+    int foundAll = found;
+    Controller->AllReduce(&found, &foundAll, 1, vtkCommunicator::MIN_OP);
+    checkpoint = foundAll ? latest : -1;
+  }
+  if (checkpoint >= 0 && MissesTargetResults(checkpoint)) {
+    checkpoint = -1;
+  }
+
+  if (checkpoint >= 0) {
+    Checkpoints.Restore(checkpoint, Particles, NumAdvectionSteps, Velocity[1]);
+    Checkpoints.CountHit();
+    TimestepT0 = TimestepT1 = checkpoint;
+    LastLoadedTimestep = checkpoint;
+    UseCache = true;
+  }
+  else if (ResumeFromCheckpointFile(current)) {
+    Checkpoints.CountHit();
+  }
+  else if (!UseCache) {
+    Checkpoints.CountMiss();
+  }
+  vtkDebugMacro(<< "Checkpoints: " << Checkpoints.GetNumberOfHits() << " hits, "
+		<< Checkpoints.GetNumberOfMisses() << " misses, "
+		<< Checkpoints.GetNumberOfCheckpoints() << " stored in "
+		<< Checkpoints.GetMemorySize() << " bytes");
+}
+
+//----------------------------------------------------------------------------
+CheckpointKey vtkVofTopo::GetCheckpointKey() const
+{
+  CheckpointKey key;
+  key.initTimeStep = InitTimeStep;
+  key.refinement = Refinement;
+  key.timeStepDelta = TimeStepDelta;
+  key.datasetHash = DatasetHash;
+
+  const int settings[11] = {Integrator, TemporalInterpolation, TimeStepStride,
+			    VelocityPrecision, CompressVof, CompactInterval,
+			    SortInterval, NumGhostLevels, int(Incr),
+			    TargetStride, BrickVof};
+  const double tolerances[2] = {IntegrationTolerance, CFLNumber};
+  key.settingsHash = hashBytes(settings, sizeof(settings));
+  key.settingsHash = hashBytes(tolerances, sizeof(tolerances), key.settingsHash);
+  // targets of the batch mode are time steps of the advection
+  if (!TargetTimeSteps.empty()) {
+    key.settingsHash = hashBytes(&TargetTimeSteps[0],
+				 TargetTimeSteps.size()*sizeof(int),
+				 key.settingsHash);
+  }
+  return key;
+}
+
+//----------------------------------------------------------------------------
+std::string vtkVofTopo::GetCheckpointFileName(const CheckpointKey &key) const
+{
+  const bool parallel = Controller->GetCommunicator() != 0;
+  return checkpointFileName(CheckpointDirectory, key,
+			    parallel ? Controller->GetLocalProcessId() : 0,
+			    parallel ? Controller->GetNumberOfProcesses() : 1);
+}
+
+//----------------------------------------------------------------------------
+// Restores the checkpoint file of an earlier run with the same key if its
+// time step lies between the current state and TargetTimeStep and all
+// processes have a file for the same time step. The file has no results
+// of the batch mode, so it is only used if the targets up to its time step
+// are still kept
+bool vtkVofTopo::ResumeFromCheckpointFile(const int current)
+{
+  if (CheckpointDirectory == 0 || CheckpointDirectory[0] == 0) {
+    return false;
+  }
+  const CheckpointKey key = GetCheckpointKey();
+  const std::string fileName = GetCheckpointFileName(key);
+
+  int timestep = readCheckpointTimestep(fileName, key);
+  if (timestep < std::max(InitTimeStep, current+1) || timestep >= TargetTimeStep) {
+    timestep = -1;
+  }
+  if (Controller->GetCommunicator() != 0) {
+    int minTimestep = timestep;
+    int maxTimestep = timestep;
+    Controller->AllReduce(&timestep, &minTimestep, 1, vtkCommunicator::MIN_OP);
+    Controller->AllReduce(&timestep, &maxTimestep, 1, vtkCommunicator::MAX_OP);
+    timestep = minTimestep == maxTimestep ? minTimestep : -1;
+  }
+  if (timestep < 0) {
+    return false;
+  }
+  if (MissesTargetResults(timestep)) {
+    vtkDebugMacro(<< "Not resuming from checkpoint " << fileName
+		  << ", the results of earlier targets are missing");
+    return false;
+  }
+
+  vtkPolyData *seeds = vtkPolyData::New();
+  int ok = readCheckpointFile(fileName, key, timestep, NumAdvectionSteps,
+			      Particles, seeds, Velocity[1]);
+  if (Controller->GetCommunicator() != 0) {
+    int okAll = ok;
+    Controller->AllReduce(&ok, &okAll, 1, vtkCommunicator::MIN_OP);
+    ok = okAll;
+  }
+  if (!ok) {
+    // the particles may be partly overwritten, start over
+    vtkWarningMacro(<<"Could not read checkpoint " << fileName);
+    seeds->Delete();
+    UseCache = false;
+    LastLoadedTimestep = -1;
+    return false;
+  }
+
+  if (Seeds != 0) {
+    Seeds->Delete();
+  }
+  Seeds = seeds;
+  InitBoundaries();
+
+  vtkDebugMacro(<< "Resuming from checkpoint " << fileName << " at time step "
+		<< timestep);
+  TimestepT0 = TimestepT1 = timestep;
+  LastLoadedTimestep = timestep;
+  UseCache = true;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+int vtkVofTopo::NextTimestep(int timestep) const
+{
+  int stride = TimeStepStride > 1 ? TimeStepStride : 1;
+  int next = std::min(timestep + stride, TargetTimeStep);
+  // do not step over targets of the batch mode
+  for (int t = timestep + 1; t < next; ++t) {
+    if (IsBatchTarget(t)) {
+      return t;
+    }
+  }
+  return next;
+}
+
+//----------------------------------------------------------------------------
+namespace
+{
+  inline double numExtentCells(const int extent[6])
+  {
+    double numCells = 1.0;
+    for (int c = 0; c < 3; ++c) {
+      numCells *= std::max(extent[c*2+1] - extent[c*2+0], 1);
+    }
+    return numCells;
+  }
+}
+
+// Extent of the piece around the particles for the advection from
+// TimestepT0 to TimestepT1; returns false if TimestepT1 needs the whole
+// piece: the seeding, the components at targets and the other modes
+bool vtkVofTopo::GetRegionOfInterest(int extent[6])
+{
+  if (!RegionOfInterest || !HasPieceExtent || UseFlowMaps() ||
+      BackwardTimestep >= 0 || TimestepT0 == TimestepT1 ||
+      TimestepT1 >= TargetTimeStep || IsBatchTarget(TimestepT1)) {
+    return false;
+  }
+  WaitForAdvection();
+
+  float bounds[6] = {std::numeric_limits<float>::max(),
+		     -std::numeric_limits<float>::max(),
+		     std::numeric_limits<float>::max(),
+		     -std::numeric_limits<float>::max(),
+		     std::numeric_limits<float>::max(),
+		     -std::numeric_limits<float>::max()};
+  float maxSpeed = 0.0f;
+  size_t numAlive = 0;
+  for (size_t i = 0; i < Particles.Size(); ++i) {
+    if (!Particles.IsAlive(i)) {
+      continue;
+    }
+    const float4 p = Particles.GetPosition(i);
+    bounds[0] = std::min(bounds[0], p.x);
+    bounds[1] = std::max(bounds[1], p.x);
+    bounds[2] = std::min(bounds[2], p.y);
+    bounds[3] = std::max(bounds[3], p.y);
+    bounds[4] = std::min(bounds[4], p.z);
+    bounds[5] = std::max(bounds[5], p.z);
+    maxSpeed = std::max(maxSpeed, length(Particles.GetVelocity(i)));
+    ++numAlive;
+  }
+
+  if (numAlive == 0) {
+    // nothing to advect, the smallest extent of the piece will do
+    for (int c = 0; c < 3; ++c) {
+      extent[c*2+0] = PieceExtent[c*2+0];
+      extent[c*2+1] = std::min(PieceExtent[c*2+0]+1, PieceExtent[c*2+1]);
+    }
+  }
+  else {
+    const float margin = RegionOfInterestMargin*maxSpeed*
+      std::abs(GetAdvectionDeltaT(TimestepT0, TimestepT1));
+    const float lower[3] = {bounds[0]-margin, bounds[2]-margin, bounds[4]-margin};
+    const float upper[3] = {bounds[1]+margin, bounds[3]+margin, bounds[5]+margin};
+    int ijkLower[3], ijkUpper[3];
+    float pcoords[3];
+    PieceLocator.FindCell(lower, ijkLower, pcoords);
+    PieceLocator.FindCell(upper, ijkUpper, pcoords);
+
+    // cell i spans the nodes i and i+1; the velocity is interpolated
+    // between cell centers, so one more cell is needed on each side
+    const int layers = 1 + NumGhostLevels;
+    for (int c = 0; c < 3; ++c) {
+      extent[c*2+0] = std::max(PieceExtent[c*2+0] + ijkLower[c] - layers,
+			       PieceExtent[c*2+0]);
+      extent[c*2+1] = std::min(PieceExtent[c*2+0] + ijkUpper[c] + 1 + layers,
+			       PieceExtent[c*2+1]);
+    }
+  }
+
+  vtkDebugMacro(<< "Region of interest at time step " << TimestepT1 << ": ["
+		<< extent[0] << "," << extent[1] << "]x[" << extent[2] << ","
+		<< extent[3] << "]x[" << extent[4] << "," << extent[5] << "], "
+		<< 100.0*numExtentCells(extent)/numExtentCells(PieceExtent)
+		<< "% of the piece");
+  return true;
+}
+
+//----------------------------------------------------------------------------
+int vtkVofTopo::GetRequestedTimestep(vtkInformation *outInfo) const
+{
+  double time = outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_TIME_STEP());
+  if (time > InputTimeValues.back()) {
+    time = InputTimeValues.back();
+  }
+  int timestep = findClosestTimeStep(time, InputTimeValues);
+
+  if (timestep < 0) {
+    timestep = 0;
+  }
+  if (timestep > InputTimeValues.size()-1) {
+    timestep = InputTimeValues.size()-1;
+  }
+  return timestep;
+}
+
+//----------------------------------------------------------------------------
+void vtkVofTopo::AddTargetTimeStep(int timestep)
+{
+  TargetTimeSteps.push_back(timestep);
+  Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkVofTopo::RemoveAllTargetTimeSteps()
+{
+  if (!TargetTimeSteps.empty()) {
+    TargetTimeSteps.clear();
+    Modified();
+  }
+}
+
+//----------------------------------------------------------------------------
+bool vtkVofTopo::IsBatchMode() const
+{
+  return (TargetStride > 0 || !TargetTimeSteps.empty()) &&
+    ParticlesResumable();
+}
+
+//----------------------------------------------------------------------------
+// The particles of a backward sweep or an adaptive refinement pass are
+// chosen for TargetTimeStep, so they cannot continue to other targets
+bool vtkVofTopo::ParticlesResumable() const
+{
+  return LabelingMode == LABELING_FORWARD && !UseAdaptiveRefinement();
+}
+
+//----------------------------------------------------------------------------
+bool vtkVofTopo::IsBatchTarget(const int timestep) const
+{
+  if (timestep <= InitTimeStep) {
+    return false;
+  }
+  if (TargetStride > 0 && (timestep - InitTimeStep)%TargetStride == 0) {
+    return true;
+  }
+  return std::find(TargetTimeSteps.begin(), TargetTimeSteps.end(),
+		   timestep) != TargetTimeSteps.end();
+}
+
+//----------------------------------------------------------------------------
+// A run resumed at timestep continues after it, so the results of the
+// targets up to timestep must be kept from the run that got there
+bool vtkVofTopo::MissesTargetResults(const int timestep) const
+{
+  for (int t = InitTimeStep+1; t <= timestep; ++t) {
+    if (IsBatchTarget(t) && TargetResults.find(t) == TargetResults.end()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+// Keeps the seeds with their current labels, the particles and the
+// boundaries at TimestepT1, in the layout of blocks 0-2 of the output
+void vtkVofTopo::StoreTargetResult(vtkPolyData *particles,
+				   vtkPolyData *boundaries)
+{
+  // the labels of Seeds and Boundaries are replaced at the next target
+  vtkSmartPointer<vtkPolyData> seeds = vtkSmartPointer<vtkPolyData>::New();
+  seeds->ShallowCopy(Seeds);
+  vtkSmartPointer<vtkPolyData> targetBoundaries = vtkSmartPointer<vtkPolyData>::New();
+  targetBoundaries->ShallowCopy(boundaries);
+
+  vtkSmartPointer<vtkMultiBlockDataSet> result =
+    vtkSmartPointer<vtkMultiBlockDataSet>::New();
+  result->SetBlock(0, seeds);
+  result->SetBlock(1, particles);
+  result->SetBlock(2, targetBoundaries);
+
+  vtkSmartPointer<vtkDoubleArray> timeValue = vtkSmartPointer<vtkDoubleArray>::New();
+  timeValue->SetName("TimeValue");
+  timeValue->SetNumberOfComponents(1);
+  timeValue->SetNumberOfTuples(1);
+  timeValue->SetValue(0, InputTimeValues[TimestepT1]);
+  result->GetFieldData()->AddArray(timeValue);
+
+  TargetResults[TimestepT1] = result;
+}
+
+//----------------------------------------------------------------------------
+// Results of the batch mode in time order, one block per target
+void vtkVofTopo::GetTargetResults(vtkMultiBlockDataSet *results)
+{
+  unsigned int block = 0;
+  std::map<int, vtkSmartPointer<vtkMultiBlockDataSet> >::iterator it;
+  for (it = TargetResults.begin(); it != TargetResults.end(); ++it) {
+    // targets of earlier runs may have been removed since
+    if (it->first != TargetTimeStep && !IsBatchTarget(it->first)) {
+      continue;
+    }
+    std::ostringstream name;
+    name << "TimeStep" << it->first;
+    results->SetBlock(block, it->second);
+    results->GetMetaData(block)->Set(vtkCompositeDataSet::NAME(),
+				     name.str().c_str());
+    ++block;
+  }
+}
+
 //----------------------------------------------------------------------------
 void vtkVofTopo::PrintSelf(ostream& os, vtkIndent indent)
 {
@@ -313,35 +860,108 @@ void vtkVofTopo::PrintSelf(ostream& os, vtkIndent indent)
 }
 
 //----------------------------------------------------------------------------
-void vtkVofTopo::InitParticles(vtkRectilinearGrid *vof)
+void vtkVofTopo::InitBoundaries()
+{
+  Boundaries->SetPoints(vtkPoints::New());
+  vtkCellArray *cells = vtkCellArray::New();
+  Boundaries->SetPolys(cells);
+  vtkFloatArray *ivertices = vtkFloatArray::New();
+  ivertices->SetName("IVertices");
+  ivertices->SetNumberOfComponents(3);
+  Boundaries->GetPointData()->AddArray(ivertices);
+}
+
+//----------------------------------------------------------------------------
+void vtkVofTopo::InitParticles(vtkRectilinearGrid *vof,
+			       const VofSummary &summary)
 {
   vtkSmartPointer<vtkPoints> seedPoints = vtkSmartPointer<vtkPoints>::New();
   vtkSmartPointer<vtkIntArray> seedConnectivity = vtkSmartPointer<vtkIntArray>::New();
   vtkSmartPointer<vtkShortArray> seedCoords = vtkSmartPointer<vtkShortArray>::New();
 
-  generateSeedPointsPLIC(vof, Refinement, seedPoints, seedConnectivity,
-			 seedCoords, GlobalExtent, NumGhostLevels);
+  const bool adaptive = UseAdaptiveRefinement();
+  if (adaptive && RefinementLevel == 0) {
+    // the seeds of every pass start from these volume fractions
+    InitVofGrid->DeepCopy(vof);
+    InitVofSummary = summary;
+    ActiveCells.clear();
+    CellLabels.clear();
+    NumAdaptiveParticles = 0;
+  }
+
+  generateSeedPointsPLIC(vof, adaptive ? RefinementLevel : Refinement,
+			 seedPoints, seedConnectivity, seedCoords,
+			 GlobalExtent, NumGhostLevels, summary.mask,
+			 summary.interfaces,
+			 summary.bricks.IsEmpty() ? 0 : &summary.bricks,
+			 NumThreads);
   
-  Particles.clear();
-  ParticleIds.clear();
-  ParticleProcs.clear();
+  const int processId = Controller->GetCommunicator() != 0 ?
+    Controller->GetLocalProcessId() : 0;
+  const int numSeeds = seedPoints->GetNumberOfPoints();
+
+  // after a backward sweep only seeds in ambiguous cells are advected, the
+  // others get the label of their cell
+  SeedLabels.clear();
+  if (HasBackwardLabels) {
+    SeedLabels.resize(numSeeds, -10.0f);
+    RectilinearLocator locator;
+    buildLocator(vof, locator);
+    int nodeRes[3];
+    vof->GetDimensions(nodeRes);
+    for (int i = 0; i < numSeeds; ++i) {
+      double p[3];
+      seedPoints->GetPoint(i, p);
+      int ijk[3];
+      double pcoords[3];
+      if (locator.FindCell(p, ijk, pcoords)) {
+	int idx = ijk[0] + ijk[1]*(nodeRes[0]-1) +
+	  ijk[2]*(nodeRes[0]-1)*(nodeRes[1]-1);
+	if (BackwardCellLabels[idx] >= 0) {
+	  SeedLabels[i] = BackwardCellLabels[idx];
+	}
+      }
+    }
+    HasBackwardLabels = false;
+  }
+  // in later passes of the adaptive refinement the seeds of resolved cells
+  // inherit the label of their cell
+  else if (adaptive && !ActiveCells.empty()) {
+    SeedLabels.resize(numSeeds, -10.0f);
+    int nodeRes[3];
+    vof->GetDimensions(nodeRes);
+    for (int i = 0; i < numSeeds; ++i) {
+      int ijk[3];
+      for (int c = 0; c < 3; ++c) {
+	ijk[c] = static_cast<int>(seedCoords->GetComponent(i, c)) >> RefinementLevel;
+      }
+      int idx = ijk[0] + ijk[1]*(nodeRes[0]-1) +
+	ijk[2]*(nodeRes[0]-1)*(nodeRes[1]-1);
+      if (!ActiveCells[idx]) {
+	SeedLabels[i] = CellLabels[idx];
+      }
+    }
+  }
 
-  Particles.resize(seedPoints->GetNumberOfPoints());
-  for (int i = 0; i < seedPoints->GetNumberOfPoints(); ++i) {
+  Particles.Clear();
+  Particles.Reserve(numSeeds);
+  for (int i = 0; i < numSeeds; ++i) {
+    if (!SeedLabels.empty() && SeedLabels[i] != -10.0f) {
+      continue;
+    }
     double p[3];
     seedPoints->GetPoint(i, p);
-    Particles[i] = make_float4(p[0], p[1], p[2], 1.0f);
+    Particles.Append(make_float4(p[0], p[1], p[2], 1.0f),
+		     make_float4(0.0f, 0.0f, 0.0f, 0.0f), i, processId);
   }
-  if (Controller->GetCommunicator() != 0) {
-
-    const int processId = Controller->GetLocalProcessId();
-
-    ParticleIds.resize(seedPoints->GetNumberOfPoints());
-    ParticleProcs.resize(seedPoints->GetNumberOfPoints());
-    for (int i = 0; i < seedPoints->GetNumberOfPoints(); ++i) {
-      ParticleIds[i] = i;
-      ParticleProcs[i] = processId;
-    }
+  Particles.ShrinkToFit();
+  NumAdvectionSteps = 0;
+  if (!SeedLabels.empty()) {
+    vtkDebugMacro(<< "Advecting " << Particles.Size() << " of " << numSeeds
+		  << " seeds, the others are already labeled");
+  }
+  if (adaptive) {
+    NumAdaptiveParticles += Particles.Size();
   }
 
   if (Seeds != 0) {
@@ -354,13 +974,117 @@ void vtkVofTopo::InitParticles(vtkRectilinearGrid *vof)
 }
 
 //----------------------------------------------------------------------------
-void vtkVofTopo::InitVelocities(vtkRectilinearGrid *velocity)
+namespace
+{
+  vtkDataArray *copyArray(vtkDataArray *array, size_t &copiedBytes)
+  {
+    vtkDataArray *copy = array->NewInstance();
+    copy->DeepCopy(array);
+    copiedBytes += size_t(array->GetNumberOfTuples())*
+      array->GetNumberOfComponents()*array->GetDataTypeSize();
+    return copy;
+  }
+}
+
+// Loads the volume fractions of the input into VofGrid[1]. The grid shares
+// the coordinates and the "Data" array of the input by reference, other
+// arrays are not kept. An array shared by VofGrid[1] is still in the
+// window after the next load, so a reader must not refill it in place: an
+// array is only shared if the input hands out a different array object
+// than at the last load. Arrays handed out again, the arrays of the first
+// load and the arrays forced by copyCoordinates and copyData are copied.
+// The number of copied bytes goes to CopiedVofBytes.
+void vtkVofTopo::LoadVofTimeStep(vtkRectilinearGrid *input,
+				 const bool copyCoordinates,
+				 const bool copyData)
+{
+  CopiedVofBytes = 0;
+  int index;
+  vtkDataArray *data = input->GetCellData()->GetArray("Data", index);
+  if (index == -1) {
+    std::cout << __LINE__ << ": Array not found!" << std::endl;
+  }
+
+  vtkDataArray *arrays[NUM_INPUT_ARRAYS] = {input->GetXCoordinates(),
+					    input->GetYCoordinates(),
+					    input->GetZCoordinates(),
+					    data};
+  for (int a = 0; a < NUM_INPUT_ARRAYS; ++a) {
+    vtkDataArray *array = arrays[a];
+    if (array == 0) {
+      LastInputArrays[a] = 0;
+      LastInputShared[a] = false;
+      continue;
+    }
+    const bool firstLoad = LastInputArrays[a] == 0;
+    const bool handedOutAgain = array == LastInputArrays[a].GetPointer();
+    if (handedOutAgain && LastInputShared[a] &&
+	array->GetMTime() != LastInputMTimes[a]) {
+      vtkWarningMacro(<<"An input array shared with the last time step was "
+		      << "modified in place, the time step window is invalid");
+    }
+    // the last array is kept alive, so a new one cannot have its address;
+    // nothing is known about the reader at the first load
+    LastInputArrays[a] = array;
+    LastInputMTimes[a] = array->GetMTime();
+    const bool forceCopy = a < 3 ? copyCoordinates : copyData;
+    LastInputShared[a] = !firstLoad && !handedOutAgain && !forceCopy;
+    if (!LastInputShared[a]) {
+      arrays[a] = copyArray(array, CopiedVofBytes);
+    }
+  }
+
+  vtkRectilinearGrid *grid = VofGrid[1];
+  grid->Initialize();
+  grid->SetExtent(input->GetExtent());
+  grid->SetXCoordinates(arrays[0]);
+  grid->SetYCoordinates(arrays[1]);
+  grid->SetZCoordinates(arrays[2]);
+  if (arrays[3] != 0) {
+    grid->GetCellData()->SetScalars(arrays[3]);
+  }
+
+  for (int a = 0; a < NUM_INPUT_ARRAYS; ++a) {
+    if (arrays[a] != 0 && !LastInputShared[a]) {
+      arrays[a]->Delete();
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkVofTopo::SummarizeVofTimeStep()
+{
+  if (CompressVof) {
+    compressVof(VofGrid[1]);
+  }
+  VofSummary &summary = VofSummaries[1];
+  buildOccupancyMask(VofGrid[1], summary.mask, NumThreads);
+  summary.interfaces.Build(summary.mask, NumThreads);
+  if (!BrickVof) {
+    summary.bricks.Clear();
+    return;
+  }
+
+  buildBrickedVolume(VofGrid[1], summary.bricks, NumThreads);
+  VofGrid[1]->GetCellData()->RemoveArray("Data");
+  vtkDebugMacro(<< "Bricked volume fractions: "
+		<< summary.bricks.GetNumberOfMixedBricks() << " of "
+		<< summary.bricks.GetBrickRes()[0]*summary.bricks.GetBrickRes()[1]*
+		   summary.bricks.GetBrickRes()[2] << " bricks mixed, "
+		<< summary.bricks.GetMemorySize() << " bytes");
+}
+
+//----------------------------------------------------------------------------
+const BrickedVolume *vtkVofTopo::GetVofBricks(const int slot) const
 {
-  Velocities.clear();
-  vtkPoints *seedPoints = Seeds->GetPoints();
-  Velocities.resize(seedPoints->GetNumberOfPoints());
+  const BrickedVolume &bricks = VofSummaries[slot].bricks;
+  return bricks.IsEmpty() ? 0 : &bricks;
+}
 
-  initVelocities(velocity, Particles, Velocities);
+//----------------------------------------------------------------------------
+void vtkVofTopo::InitVelocities(const VelocityCache &velocity)
+{
+  initVelocities(velocity, Particles, NumThreads);
 }
 void computeBoundsWithoutGhost(double globalBounds[6], double localBounds[6], 
 			       vtkDataArray *xCoordinates, 
@@ -456,159 +1180,298 @@ void vtkVofTopo::GetGlobalContext(vtkInformation *inInfo)
 			    inputVof->GetYCoordinates(), 
 			    inputVof->GetZCoordinates(), 
 			    BoundsNoGhosts);
+  HasGlobalContext = true;
 }
 
 //----------------------------------------------------------------------------
 void vtkVofTopo::AdvectParticles(vtkRectilinearGrid *vof[2],
-				 vtkRectilinearGrid *velocity[2])
+				 const VelocityCache velocity[2],
+				 const bool async)
 {  
-  float dt = InputTimeValues[TimestepT1] - InputTimeValues[TimestepT0];
-  if (TimeStepDelta != 0.0) {
-    dt = TimeStepDelta;
+  const float dt = GetAdvectionDeltaT(TimestepT0, TimestepT1);
+  const AdvectionParams params = GetAdvectionParams();
+
+  AdvectedTimestep = TimestepT1;
+
+  if (async) {
+    // everything the thread reads is owned by the filter and stays in place
+    // until WaitForAdvection: the slots and caches rotate only after it
+    vtkRectilinearGrid *vof1 = vof[1];
+    const BrickedVolume *bricks1 = GetVofBricks(1);
+    AdvectionPending = true;
+    AdvectionThread = std::thread([this, vof1, bricks1, velocity, dt, params]() {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      advectParticles(vof1, bricks1, velocity, Particles, dt, params,
+		      PendingStats);
+      AdvectionTime = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+						    start).count();
+    });
+    return;
   }
-  
-  dt *= Incr;
-  
-  advectParticles(vof[1], velocity[1], Particles, Velocities, dt);
-  if (Controller->GetCommunicator() != 0) {
-    ExchangeParticles();
+
+  advectParticles(vof[1], GetVofBricks(1), velocity, Particles, dt, params,
+		  PendingStats);
+  FinishAdvection();
+}
+
+//----------------------------------------------------------------------------
+float vtkVofTopo::GetAdvectionDeltaT(const int timestep0,
+				     const int timestep1) const
+{
+  float dt = InputTimeValues[timestep1] - InputTimeValues[timestep0];
+  if (TimeStepDelta != 0.0) {
+    dt = TimeStepDelta*(timestep1 - timestep0);
   }
+  return dt*Incr;
 }
 
 //----------------------------------------------------------------------------
-void vtkVofTopo::ExchangeParticles()
+AdvectionParams vtkVofTopo::GetAdvectionParams() const
 {
-  int numProcesses = Controller->GetNumberOfProcesses();
-  int processId = Controller->GetLocalProcessId();
+  AdvectionParams params;
+  params.integrator = Integrator;
+  params.tolerance = IntegrationTolerance;
+  params.temporalInterpolation = TemporalInterpolation;
+  params.cflNumber = CFLNumber;
+  params.numThreads = NumThreads;
+  return params;
+}
 
-  // one vector for each side of the process
-  std::vector<std::vector<float4> > particlesToSend(numProcesses);
-  std::vector<std::vector<float4> > velocitiesToSend(numProcesses);
-  std::vector<std::vector<int> > particleIdsToSend(numProcesses);
-  std::vector<std::vector<short> > particleProcsToSend(numProcesses);
-  for (int i = 0; i < numProcesses; ++i) {
-    particlesToSend[i].resize(0);
-    velocitiesToSend[i].resize(0);
-    particleIdsToSend[i].resize(0);
-    particleProcsToSend[i].resize(0);
+//----------------------------------------------------------------------------
+void vtkVofTopo::WaitForAdvection()
+{
+  if (!AdvectionPending) {
+    return;
   }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  AdvectionThread.join();
+  AdvectionPending = false;
+  StallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+					    start).count();
+  // overlap: part of the advection hidden behind loading the next time step
+  vtkDebugMacro(<< "Advection took " << AdvectionTime << " s, stalled "
+		<< StallTime << " s waiting for it, overlap "
+		<< (AdvectionTime > 0.0 ? 100.0*std::max(AdvectionTime - StallTime, 0.0)/
+		    AdvectionTime : 100.0) << "%");
+
+  FinishAdvection();
+}
 
-  std::vector<float4>::iterator it;
-  std::vector<float4> particlesToKeep;
-  std::vector<float4> velocitiesToKeep;
-  std::vector<int> particleIdsToKeep;
-  std::vector<short> particleProcsToKeep;
-
-  for (int i = 0; i < Particles.size(); ++i) {
+//----------------------------------------------------------------------------
+// Particles of RK45 integrations that ran out of sub-steps reach the end of
+// the interval, but with a larger error than IntegrationTolerance
+void vtkVofTopo::WarnForcedSteps(const AdvectionStats &stats)
+{
+  if (stats.numForcedSteps > 0) {
+    vtkWarningMacro(<< stats.numForcedSteps << " RK45 integrations ran out of "
+		    << "sub-steps, their last sub-step exceeds the tolerance");
+  }
+}
 
-    int bound = outOfBounds(Particles[i], BoundsNoGhosts, GlobalBounds);
+//----------------------------------------------------------------------------
+void vtkVofTopo::FinishAdvection()
+{
+  const AdvectionStats &stats = PendingStats;
+  if (stats.numParticles > 0) {
+    vtkDebugMacro(<< "Advected " << stats.numParticles << " particles: "
+		  << double(stats.numIterations)/stats.numParticles
+		  << " iterations and "
+		  << double(stats.numVelocitySamples)/stats.numParticles
+		  << " velocity samples per particle");
+  }
+  WarnForcedSteps(stats);
+
+  ++NumAdvectionSteps;
+  if (CompactInterval > 0 && NumAdvectionSteps % CompactInterval == 0) {
+    size_t numRemoved = Particles.Compact();
+    if (numRemoved > 0) {
+      vtkDebugMacro(<< "Removed " << numRemoved << " dead particles, "
+		    << Particles.Size() << " left");
+    }
+  }
+  if (Controller->GetCommunicator() != 0) {
+    ExchangeParticles();
+  }
+  // after the exchange, which appends the received particles at the end
+  if (SortInterval > 0 && NumAdvectionSteps % SortInterval == 0) {
+    sortParticles(Velocity[1].GetLocator(), Particles, NumThreads);
+  }
+  if (CheckpointInterval > 0 && NumAdvectionSteps % CheckpointInterval == 0 &&
+      ParticlesResumable()) {
+    // the velocity is needed again only for temporal interpolation
+    Checkpoints.SetBudget(size_t(std::max(CheckpointBudget, 0)) << 20);
+    Checkpoints.Store(AdvectedTimestep, Particles, NumAdvectionSteps,
+		      TemporalInterpolation ? &Velocity[1] : 0);
+
+    if (CheckpointDirectory != 0 && CheckpointDirectory[0] != 0) {
+      const std::string fileName = GetCheckpointFileName(GetCheckpointKey());
+      if (!writeCheckpointFile(fileName, GetCheckpointKey(), AdvectedTimestep,
+			       NumAdvectionSteps, Particles, Seeds,
+			       TemporalInterpolation ? &Velocity[1] : 0)) {
+	vtkWarningMacro(<<"Could not write checkpoint " << fileName);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+namespace
+{
+  // all attributes of a particle in one message
+  struct PackedParticle
+  {
+    float x, y, z;
+    float vx, vy, vz;
+    int id;
+    short proc;
+  };
+
+  PackedParticle packParticle(const ParticleStore &particles, size_t i)
+  {
+    float4 p = particles.GetPosition(i);
+    float4 v = particles.GetVelocity(i);
+    PackedParticle packed = {p.x, p.y, p.z, v.x, v.y, v.z,
+			     particles.GetId(i), particles.GetProc(i)};
+    return packed;
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkVofTopo::ExchangeParticles()
+{
+  int numProcesses = Controller->GetNumberOfProcesses();
+  int processId = Controller->GetLocalProcessId();
+
+  // one vector for each process
+  std::vector<std::vector<PackedParticle> > particlesToSend(numProcesses);
+
+  // particles that stay are moved to the front of the store; dead particles
+  // always stay so that their seeds get labeled here
+  size_t numKept = 0;
+  for (size_t i = 0; i < Particles.Size(); ++i) {
+
+    int bound = -1;
+    if (Particles.IsAlive(i)) {
+      bound = outOfBounds(Particles.GetPosition(i), BoundsNoGhosts, GlobalBounds);
+    }
     if (bound > -1) {
+      PackedParticle packed = packParticle(Particles, i);
       for (int j = 0; j < numProcesses; ++j) {
 
   	int neighborId = j;
 	if (neighborId != processId) {
-	  particlesToSend[neighborId].push_back(Particles[i]);
-	  velocitiesToSend[neighborId].push_back(Velocities[i]);
-	  particleIdsToSend[neighborId].push_back(ParticleIds[i]);
-	  particleProcsToSend[neighborId].push_back(ParticleProcs[i]);
+	  particlesToSend[neighborId].push_back(packed);
 	}
       }
-
     }
     else {
-      particlesToKeep.push_back(Particles[i]);
-      velocitiesToKeep.push_back(Velocities[i]);
-      particleIdsToKeep.push_back(ParticleIds[i]);
-      particleProcsToKeep.push_back(ParticleProcs[i]);
-    }
-  }
- 
-  Particles = particlesToKeep;
-  Velocities = velocitiesToKeep;
-  ParticleIds = particleIdsToKeep;
-  ParticleProcs = particleProcsToKeep;
-
-  std::vector<float4> particlesToRecv;
-  std::vector<float4> velocitiesToRecv;
-  std::vector<int> particleIdsToRecv;
-  std::vector<short> particleProcsToRecv;
+      if (numKept != i) {
+	Particles.Move(numKept, i);
+      }
+      ++numKept;
+    }
+  }
+  Particles.Resize(numKept);
+
+  std::vector<PackedParticle> particlesToRecv;
   sendData(particlesToSend, particlesToRecv, numProcesses, Controller);
-  sendData(velocitiesToSend, velocitiesToRecv, numProcesses, Controller);
-  sendData(particleIdsToSend, particleIdsToRecv, numProcesses, Controller);
-  sendData(particleProcsToSend, particleProcsToRecv, numProcesses, Controller);
 
   // insert the paricles that are within the domain
   for (int i = 0; i < particlesToRecv.size(); ++i) {
-    int within = withinBounds(particlesToRecv[i], BoundsNoGhosts);
+    const PackedParticle &packed = particlesToRecv[i];
+    float4 position = make_float4(packed.x, packed.y, packed.z, 1.0f);
+    int within = withinBounds(position, BoundsNoGhosts);
     if (within) {
-      Particles.push_back(particlesToRecv[i]);
-      Velocities.push_back(velocitiesToRecv[i]);
-      ParticleIds.push_back(particleIdsToRecv[i]);
-      ParticleProcs.push_back(particleProcsToRecv[i]);
+      Particles.Append(position, make_float4(packed.vx, packed.vy, packed.vz, 0.0f),
+		       packed.id, packed.proc);
     }
   }
 }
 
 //----------------------------------------------------------------------------
 void vtkVofTopo::ExtractComponents(vtkRectilinearGrid *vof,
+				   const OccupancyMask &mask, const int timestep,
 				   vtkRectilinearGrid *components)
 {
-  int nodeRes[3];
-  vof->GetDimensions(nodeRes);
-  int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
-
-  vtkDataArray *data = vof->GetCellData()->GetAttribute(vtkDataSetAttributes::SCALARS);
-
   vtkFloatArray *labels = vtkFloatArray::New();
   labels->SetName("Labels");
   labels->SetNumberOfComponents(1);
   labels->SetNumberOfTuples(vof->GetNumberOfCells());
-  for (int i = 0; i < labels->GetNumberOfTuples(); ++i) {
-    labels->SetValue(i, -1.0f);
+
+  ComponentKey key;
+  key.timestep = timestep;
+  vtkAlgorithm *producer = GetInputAlgorithm(1, 0);
+  key.inputMTime = producer != 0 ? producer->GetMTime() : 0;
+  key.settingsHash = GetComponentSettingsHash(vof);
+
+  // the unification is collective, so either all processes restore their
+  // labels or all compute them
+  Components.SetBudget(size_t(std::max(ComponentCacheBudget, 0)) << 20);
+  int cached = Components.Has(key, labels->GetNumberOfTuples());
+  if (Controller->GetCommunicator() != 0) {
+    int allCached = cached;
+    Controller->AllReduce(&cached, &allCached, 1, vtkCommunicator::MIN_OP);
+    cached = allCached;
   }
 
-  g_labelId = 0;
-  // determine if data is float or double
-  if (data->IsA("vtkFloatArray")) {
-    extractComponents(vtkFloatArray::SafeDownCast(data)->GetPointer(0),
-  		      cellRes, labels->GetPointer(0));
+  if (cached) {
+    Components.Restore(key, labels->GetPointer(0), labels->GetNumberOfTuples());
+    Components.CountHit();
   }
-  else if (data->IsA("vtkDoubleArray")) {
-    extractComponents(vtkDoubleArray::SafeDownCast(data)->GetPointer(0),
-  		      cellRes, labels->GetPointer(0));
+  else {
+    ComputeComponents(vof, mask, labels);
+    Components.Store(key, labels->GetPointer(0), labels->GetNumberOfTuples());
+    Components.CountMiss();
   }
+  vtkDebugMacro(<< "Components: " << Components.GetNumberOfHits() << " hits, "
+		<< Components.GetNumberOfMisses() << " misses, "
+		<< Components.GetNumberOfEntries() << " stored in "
+		<< Components.GetMemorySize() << " bytes");
 
-  //--------------------------------------------------------------------------
-  // send number of labels to other processes
-  if (Controller->GetCommunicator() != 0) {
+  components->SetExtent(vof->GetExtent());
+  components->SetXCoordinates(vof->GetXCoordinates());
+  components->SetYCoordinates(vof->GetYCoordinates());
+  components->SetZCoordinates(vof->GetZCoordinates());
+  components->GetCellData()->AddArray(labels);
+  components->GetCellData()->SetActiveScalars("Labels");
+  labels->Delete();
+}
 
-    int numProcesses = this->Controller->GetNumberOfProcesses();
-    int processId = Controller->GetLocalProcessId();
+//----------------------------------------------------------------------------
+// Everything besides the values of the volume fractions that the unified
+// labels depend on
+unsigned long long vtkVofTopo::GetComponentSettingsHash(vtkRectilinearGrid *vof)
+{
+  int extent[NUM_SIDES];
+  vof->GetExtent(extent);
+  unsigned long long hash = hashBytes(extent, sizeof(extent), DatasetHash);
+  hash = hashBytes(GlobalExtent, sizeof(GlobalExtent), hash);
+  const int settings[3] = {NumGhostLevels, CompressVof,
+			   Controller->GetNumberOfProcesses()};
+  return hashBytes(settings, sizeof(settings), hash);
+}
 
-    // -----------------------------------------------------------------------
-    // gather number of labels from other processes
-    std::vector<vtkIdType> recvLengths(numProcesses);
-    std::vector<vtkIdType> recvOffsets(numProcesses);
-    for (int i = 0; i < numProcesses; ++i) {
-      recvLengths[i] = 1;
-      recvOffsets[i] = i;
-    }
+//----------------------------------------------------------------------------
+void vtkVofTopo::ComputeComponents(vtkRectilinearGrid *vof,
+				   const OccupancyMask &mask,
+				   vtkFloatArray *labels)
+{
+  int nodeRes[3];
+  vof->GetDimensions(nodeRes);
+  int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
 
-    int numMyLabels = g_labelId;
-    std::vector<int> allNumLabels(numProcesses);
-    Controller->AllGatherV(&numMyLabels, &allNumLabels[0], 1, &recvLengths[0], &recvOffsets[0]);
-    std::vector<int> labelOffsets(numProcesses);
-    labelOffsets[0] = 0;
-    for (int i = 1; i < numProcesses; ++i) {
-      labelOffsets[i] = labelOffsets[i-1] + allNumLabels[i-1];
-    }
-    int numAllLabels = labelOffsets.back() + allNumLabels.back();
+  const int numMyLabels =
+    extractComponents(mask, labels->GetPointer(0), NumThreads);
+  if (numMyLabels > g_maxNumLabels) {
+    vtkErrorMacro(<< numMyLabels << " components exceed the "
+		  << g_maxNumLabels << " labels a float array holds exactly");
+  }
 
-    // ------------------------
-    for (int i = 0; i < numProcesses; ++i) {
-      recvLengths[i] = NUM_SIDES;
-      recvOffsets[i] = i*NUM_SIDES;
-    }
+  //--------------------------------------------------------------------------
+  // unify the labels with the neighbor processes
+  if (Controller->GetCommunicator() != 0) {
+
+    int processId = Controller->GetLocalProcessId();
 
     // -----------------------------------------------------------------------
     // prepare labelled cells to send to neighbors
@@ -685,39 +1548,89 @@ void vtkVofTopo::ExtractComponents(vtkRectilinearGrid *vof,
 
     // -----------------------------------------------------------------------
     // identify equivalent labels from neighbor processes
-    std::vector<int> allLabels(numAllLabels);
-    for (int i = 0; i < allLabels.size(); ++i) {
-      allLabels[i] = i;
+    std::vector<int> neighbors;
+    std::vector<std::vector<LabelPair> > pairs;
+    findLabelEquivalences(NeighborProcesses, myExtent, cellRes, labels,
+			  labelsToRecv, neighbors, pairs);
+    NumLabelRounds =
+      unifyLabelsAcrossProcesses(Controller, neighbors, pairs, numMyLabels,
+				 labels);
+    if (NumLabelRounds < 0) {
+      vtkErrorMacro(<<"The components of all processes exceed the "
+		    << g_maxNumLabels << " labels a float array holds exactly, "
+		    << "the labels are not unified");
     }
-    unifyLabelsInProcess(NeighborProcesses, myExtent, cellRes,
-			 labels, labelsToRecv, labelOffsets, processId,
-			 allLabels);
+    vtkDebugMacro(<< "Unified labels with " << neighbors.size()
+		  << " neighbors in " << NumLabelRounds << " rounds");
+  }
+}
 
-    for (int i = 0; i < numProcesses; ++i) {
-      recvLengths[i] = numAllLabels;
-      recvOffsets[i] = i*numAllLabels;
-    }
-    std::vector<int> allLabelUnions(numAllLabels*numProcesses);
-    Controller->AllGatherV(&allLabels[0], &allLabelUnions[0], numAllLabels,
-    			   &recvLengths[0], &recvOffsets[0]);
+//----------------------------------------------------------------------------
+void vtkVofTopo::ComputeTopology(const int timestep,
+				 vtkPolyData *particles,
+				 vtkPolyData *boundaries)
+{
+  std::vector<float> particleLabels;
+  LabelSeeds(timestep, particleLabels);
+  BuildTopology(particleLabels, particles, boundaries);
+}
+
+//----------------------------------------------------------------------------
+void vtkVofTopo::LabelSeeds(const int timestep,
+			    std::vector<float> &particleLabels)
+{
+  // Stage III -------------------------------------------------------------
+  vtkSmartPointer<vtkRectilinearGrid> components = vtkSmartPointer<vtkRectilinearGrid>::New();
+  ExtractComponents(VofGrid[1], VofSummaries[1].mask, timestep, components);
+
+  // Stage IV --------------------------------------------------------------
+  LabelAdvectedParticles(components, particleLabels);
+
+  // Stage V ---------------------------------------------------------------
+  TransferLabelsToSeeds(particleLabels);
+}
 
-    unifyLabelsInDomain(allLabelUnions, numAllLabels, allLabels, labels,
-			labelOffsets, processId);
+//----------------------------------------------------------------------------
+void vtkVofTopo::BuildTopology(const std::vector<float> &particleLabels,
+			       vtkPolyData *particles,
+			       vtkPolyData *boundaries)
+{
+  // Transfer seed points from neighbors -----------------------------------
+  vtkPolyData *boundarySeeds = vtkPolyData::New();
+  if (Controller->GetCommunicator() != 0) {
+    ExchangeBoundarySeedPoints(boundarySeeds);
   }
 
-  components->SetExtent(vof->GetExtent());
-  components->SetXCoordinates(vof->GetXCoordinates());
-  components->SetYCoordinates(vof->GetYCoordinates());
-  components->SetZCoordinates(vof->GetZCoordinates());
-  components->GetCellData()->AddArray(labels);
-  components->GetCellData()->SetActiveScalars("Labels");
+  // Stage VI --------------------------------------------------------------
+  GenerateBoundaries(boundaries);
+
+  boundarySeeds->Delete();
+
+  // Generate output -------------------------------------------------------
+  vtkPoints *ppoints = vtkPoints::New();
+  vtkFloatArray *labels = vtkFloatArray::New();
+  ppoints->SetNumberOfPoints(Particles.Size());
+  labels->SetName("Labels");
+  labels->SetNumberOfComponents(1);
+  labels->SetNumberOfTuples(particleLabels.size());
+  for (int i = 0; i < Particles.Size(); ++i) {
+
+    float4 particle = Particles.GetPosition(i);
+    float p[3] = {particle.x, particle.y, particle.z};
+    ppoints->SetPoint(i, p);
+    labels->SetValue(i, particleLabels[i]);
+  }
+  particles->SetPoints(ppoints);
+  particles->GetPointData()->AddArray(labels);
+  ppoints->Delete();
+  labels->Delete();
 }
 
 //----------------------------------------------------------------------------
 void vtkVofTopo::LabelAdvectedParticles(vtkRectilinearGrid *components,
 					std::vector<float> &labels)
 {
-  labels.resize(Particles.size());
+  labels.resize(Particles.Size());
 
   vtkDataArray *data =
     components->GetCellData()->GetAttribute(vtkDataSetAttributes::SCALARS);
@@ -725,17 +1638,21 @@ void vtkVofTopo::LabelAdvectedParticles(vtkRectilinearGrid *components,
   components->GetDimensions(nodeRes);
   int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
 
-  for (int i = 0; i < Particles.size(); ++i) {
+  RectilinearLocator locator;
+  buildLocator(components, locator);
+
+  for (int i = 0; i < Particles.Size(); ++i) {
 
-    if (Particles[i].w == 0.0f) {
+    if (!Particles.IsAlive(i)) {
       labels[i] = -1.0f;
       continue;
     }
     
-    double x[3] = {Particles[i].x, Particles[i].y, Particles[i].z};
+    float4 particle = Particles.GetPosition(i);
+    double x[3] = {particle.x, particle.y, particle.z};
     int ijk[3];
     double pcoords[3];
-    int particleInsideGrid = components->ComputeStructuredCoordinates(x, ijk, pcoords);
+    int particleInsideGrid = locator.FindCell(x, ijk, pcoords);
 
     if (particleInsideGrid) {
       
@@ -759,15 +1676,29 @@ void vtkVofTopo::TransferLabelsToSeeds(std::vector<float> &particleLabels)
   for (int i = 0; i < Seeds->GetNumberOfPoints(); ++i) {
     labelsArray->SetValue(i, -10.0f);
   }
+  // seeds labeled by the backward sweep
+  if (SeedLabels.size() == Seeds->GetNumberOfPoints()) {
+    for (int i = 0; i < SeedLabels.size(); ++i) {
+      labelsArray->SetValue(i, SeedLabels[i]);
+    }
+  }
 
   if (sizeof(float) != sizeof(int)) {
     vtkDebugMacro("offsets computed assuming same size of int and \
  float, but they have different size");
   }
 
+  // particles removed by compaction died, like the ones labeled -1 in
+  // LabelAdvectedParticles
+  const std::vector<int> &deadIds = Particles.GetDeadIds();
+  const std::vector<short> &deadProcs = Particles.GetDeadProcs();
+
   if (Controller->GetCommunicator() == 0) {
     for (int i = 0; i < particleLabels.size(); ++i) {
-      labelsArray->SetValue(i, particleLabels[i]);
+      labelsArray->SetValue(Particles.GetId(i), particleLabels[i]);
+    }
+    for (int i = 0; i < deadIds.size(); ++i) {
+      labelsArray->SetValue(deadIds[i], -1.0f);
     }
   }
   else {
@@ -784,15 +1715,25 @@ void vtkVofTopo::TransferLabelsToSeeds(std::vector<float> &particleLabels)
 
     for (int i = 0; i < particleLabels.size(); ++i) {
 
+      const short proc = Particles.GetProc(i);
       // particle started from a seed in other process - its label and id
       // will be sent to that process
-      if (processId != ParticleProcs[i]) {
-	labelsToSend[ParticleProcs[i]].push_back(particleLabels[i]);
-	idsToSend[ParticleProcs[i]].push_back(ParticleIds[i]);
+      if (processId != proc) {
+	labelsToSend[proc].push_back(particleLabels[i]);
+	idsToSend[proc].push_back(Particles.GetId(i));
       }
       // particle started from a seed in this process
       else {
-	labelsArray->SetValue(ParticleIds[i], particleLabels[i]);
+	labelsArray->SetValue(Particles.GetId(i), particleLabels[i]);
+      }
+    }
+    for (int i = 0; i < deadIds.size(); ++i) {
+      if (processId != deadProcs[i]) {
+	labelsToSend[deadProcs[i]].push_back(-1.0f);
+	idsToSend[deadProcs[i]].push_back(deadIds[i]);
+      }
+      else {
+	labelsArray->SetValue(deadIds[i], -1.0f);
       }
     }
 
@@ -865,7 +1806,8 @@ void vtkVofTopo::GenerateBoundaries(vtkPolyData *boundaries)
   //   return;
   // }
 
-  generateBoundaries(points, labels, this->VofGrid[1], boundaries, this->Refinement);
+  generateBoundaries(points, labels, this->VofGrid[1], boundaries,
+		     this->Refinement, this->BoundaryIsoValue);
 
   //generateBoundaries(points, labels, connectivity, coords, boundaries);
   boundaries->GetPointData()->RemoveArray("IVertices");
@@ -876,3 +1818,542 @@ void vtkVofTopo::ExchangeBoundarySeedPoints(vtkPolyData *boundarySeeds)
 {
   
 }
+
+//----------------------------------------------------------------------------
+bool vtkVofTopo::UseFlowMaps() const
+{
+  return IterType == ITERATE_OVER_INIT &&
+    (Controller->GetCommunicator() == 0 ||
+     Controller->GetNumberOfProcesses() == 1);
+}
+
+//----------------------------------------------------------------------------
+// Drops the flow maps if the advection settings changed, then loads the
+// initial and target time steps and both ends of every missing interval
+void vtkVofTopo::ScheduleFlowMaps()
+{
+  CheckpointKey key = GetCheckpointKey();
+  unsigned long long hash = hashBytes(&FlowMapRefinement, sizeof(int),
+				      key.settingsHash);
+  hash = hashBytes(&key.timeStepDelta, sizeof(double), hash);
+  hash = hashBytes(&key.datasetHash, sizeof(key.datasetHash), hash);
+  if (hash != FlowMapSettingsHash) {
+    FlowMaps.Clear();
+    FlowMapSettingsHash = hash;
+  }
+  FlowMaps.Evict(size_t(std::max(FlowMapBudget, 0)) << 20,
+		 InitTimeStep, TargetTimeStep);
+
+  std::set<int> timesteps;
+  timesteps.insert(InitTimeStep);
+  timesteps.insert(TargetTimeStep);
+  for (int t = InitTimeStep; t < TargetTimeStep; ++t) {
+    if (!FlowMaps.Has(t)) {
+      timesteps.insert(t);
+      timesteps.insert(t+1);
+    }
+  }
+  FlowMapSchedule.assign(timesteps.begin(), timesteps.end());
+
+  vtkDebugMacro(<< "Flow maps: " << FlowMaps.GetNumberOfMaps() << " stored in "
+		<< FlowMaps.GetMemorySize() << " bytes, loading "
+		<< FlowMapSchedule.size() << " time steps");
+}
+
+//----------------------------------------------------------------------------
+// Advects the lattice from timestep to timestep+1, the two loaded steps
+void vtkVofTopo::ComputeFlowMap(const int timestep)
+{
+  ParticleStore lattice;
+  FlowMaps.GetLatticeParticles(lattice);
+  initVelocities(Velocity[0], lattice, NumThreads);
+
+  // nodes in the gas still carry the particles of their lattice cells,
+  // the particles die in Compose by the liquid cells of the map
+  AdvectionParams params = GetAdvectionParams();
+  params.killInEmptyCells = 0;
+  AdvectionStats stats;
+  advectParticles(VofGrid[1], GetVofBricks(1), Velocity, lattice,
+		  GetAdvectionDeltaT(timestep, timestep+1), params, stats);
+  WarnForcedSteps(stats);
+  FlowMaps.Store(timestep, lattice, VofSummaries[1].mask);
+  vtkDebugMacro(<< "Computed flow map " << timestep << "-" << timestep+1
+		<< " of " << lattice.Size() << " nodes");
+}
+
+//----------------------------------------------------------------------------
+int vtkVofTopo::RequestFlowMapData(vtkInformation *request,
+				   vtkInformationVector **inputVector,
+				   vtkInformationVector *outputVector)
+{
+  vtkInformation *inInfoVelocity = inputVector[0]->GetInformationObject(0);
+  vtkInformation *inInfoVof = inputVector[1]->GetInformationObject(0);
+
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+  vtkMultiBlockDataSet *output =
+    vtkMultiBlockDataSet::SafeDownCast(outInfo->Get(vtkDataObject::DATA_OBJECT()));
+
+  const int timestep = FlowMapSchedule[FlowMapStep];
+  const bool firstStep = FlowMapStep == 0;
+  const bool lastStep = FlowMapStep+1 == int(FlowMapSchedule.size());
+  // the loaded window, as in the advection to TargetTimeStep
+  TimestepT0 = firstStep ? timestep : FlowMapSchedule[FlowMapStep-1];
+  TimestepT1 = timestep;
+
+  if (firstStep && Controller->GetCommunicator() != 0) {
+    GetGlobalContext(inInfoVof);
+  }
+  WaitForAdvection();
+
+  std::swap(VofGrid[0], VofGrid[1]);
+  std::swap(VofSummaries[0], VofSummaries[1]);
+  Velocity[0].Swap(Velocity[1]);
+  LoadVofTimeStep(vtkRectilinearGrid::
+		  SafeDownCast(inInfoVof->Get(vtkDataObject::DATA_OBJECT())),
+		  false, false);
+  SummarizeVofTimeStep();
+  Velocity[1].Set(vtkRectilinearGrid::
+		  SafeDownCast(inInfoVelocity->Get(vtkDataObject::DATA_OBJECT())),
+		  VelocityPrecision, NumThreads);
+
+  if (firstStep) {
+    // a new lattice invalidates all maps; the schedule still starts with
+    // the initial time step
+    if (FlowMaps.SetLattice(VofGrid[1], FlowMapRefinement)) {
+      ScheduleFlowMaps();
+    }
+    InitParticles(VofGrid[1], VofSummaries[1]);
+    InitBoundaries();
+  }
+  else if (FlowMapSchedule[FlowMapStep-1] == timestep-1 &&
+	   !FlowMaps.Has(timestep-1)) {
+    ComputeFlowMap(timestep-1);
+  }
+
+  if (!lastStep) {
+    ++FlowMapStep;
+    request->Set(vtkStreamingDemandDrivenPipeline::CONTINUE_EXECUTING(), 1);
+    return 1;
+  }
+
+  request->Remove(vtkStreamingDemandDrivenPipeline::CONTINUE_EXECUTING());
+  FlowMapStep = -1;
+  // the particles do not continue an advection to TargetTimeStep
+  LastLoadedTimestep = -1;
+  TimestepT0 = TimestepT1;
+
+  if (!FlowMaps.Compose(InitTimeStep, TargetTimeStep, Particles, NumThreads)) {
+    // the particles are only partly moved to TargetTimeStep
+    vtkErrorMacro(<<"Flow map missing between time steps " << InitTimeStep
+		  << " and " << TargetTimeStep);
+    return 0;
+  }
+  if (ComputeComponentLabels && InitTimeStep < TargetTimeStep) {
+    vtkSmartPointer<vtkPolyData> particles = vtkSmartPointer<vtkPolyData>::New();
+    ComputeTopology(TargetTimeStep, particles, Boundaries);
+    output->SetBlock(1, particles);
+    output->SetBlock(2, Boundaries);
+  }
+  output->SetBlock(0, Seeds);
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Hash of the parameters and inputs a stage depends on, including those of
+// the stages before it
+unsigned long long vtkVofTopo::GetStageSignature(const StageTracker::Stage stage)
+{
+  const CheckpointKey key = GetCheckpointKey();
+  unsigned long long hash = hashBytes(&key.initTimeStep, sizeof(int),
+				      key.settingsHash);
+  hash = hashBytes(&key.refinement, sizeof(int), hash);
+  hash = hashBytes(&key.timeStepDelta, sizeof(double), hash);
+  hash = hashBytes(&key.datasetHash, sizeof(key.datasetHash), hash);
+  const int modes[2] = {LabelingMode, AdaptiveRefinement};
+  hash = hashBytes(modes, sizeof(modes), hash);
+  for (int i = 0; i < GetNumberOfInputPorts(); ++i) {
+    vtkAlgorithm *producer = GetInputAlgorithm(i, 0);
+    const unsigned long long mtime = producer != 0 ? producer->GetMTime() : 0;
+    hash = hashBytes(&mtime, sizeof(mtime), hash);
+  }
+  if (stage == StageTracker::ADVECTION) {
+    return hash;
+  }
+
+  // the labels belong to the particles at the target time step
+  hash = hashBytes(&TargetTimeStep, sizeof(int), hash);
+  if (stage == StageTracker::LABELS) {
+    return hash;
+  }
+
+  return hashBytes(&BoundaryIsoValue, sizeof(double), hash);
+}
+
+//----------------------------------------------------------------------------
+// The particles and volume fractions at TargetTimeStep are still loaded;
+// Stages III-V and VI run only if their signatures changed since they last
+// ran, otherwise their results are output again
+int vtkVofTopo::RequestReusedData(vtkInformation *request,
+				  vtkInformationVector **vtkNotUsed(inputVector),
+				  vtkInformationVector *outputVector)
+{
+  ReuseParticles = false;
+
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+  vtkMultiBlockDataSet *output =
+    vtkMultiBlockDataSet::SafeDownCast(outInfo->Get(vtkDataObject::DATA_OBJECT()));
+
+  vtkDebugMacro(<< StageTracker::Describe(StageTracker::ADVECTION, false));
+
+  if (ComputeComponentLabels) {
+    const unsigned long long labelsSignature =
+      GetStageSignature(StageTracker::LABELS);
+    int labeled = Stages.IsCurrent(StageTracker::LABELS, labelsSignature);
+    // the labeling is collective
+    if (Controller->GetCommunicator() != 0) {
+      int allLabeled = labeled;
+      Controller->AllReduce(&labeled, &allLabeled, 1, vtkCommunicator::MIN_OP);
+      labeled = allLabeled;
+    }
+    if (!labeled) {
+      LabelSeeds(TargetTimeStep, ParticleLabels);
+      Stages.Record(StageTracker::LABELS, labelsSignature);
+    }
+    vtkDebugMacro(<< StageTracker::Describe(StageTracker::LABELS, !labeled));
+
+    const unsigned long long boundariesSignature =
+      GetStageSignature(StageTracker::BOUNDARIES);
+    const bool built =
+      Stages.IsCurrent(StageTracker::BOUNDARIES, boundariesSignature);
+    if (!built) {
+      LabeledParticles = vtkSmartPointer<vtkPolyData>::New();
+      BuildTopology(ParticleLabels, LabeledParticles, Boundaries);
+      Stages.Record(StageTracker::BOUNDARIES, boundariesSignature);
+    }
+    vtkDebugMacro(<< StageTracker::Describe(StageTracker::BOUNDARIES, !built));
+
+    output->SetBlock(1, LabeledParticles);
+    output->SetBlock(2, Boundaries);
+  }
+  output->SetBlock(0, Seeds);
+
+  request->Remove(vtkStreamingDemandDrivenPipeline::CONTINUE_EXECUTING());
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// One step of the backward sweep from TargetTimeStep to InitTimeStep:
+// particles seeded in the components at the target are advected with
+// negative dt, and at the initial time step they label its cells
+int vtkVofTopo::RequestBackwardData(vtkInformation *request,
+				    vtkInformationVector **inputVector,
+				    vtkInformationVector *vtkNotUsed(outputVector))
+{
+  vtkInformation *inInfoVelocity = inputVector[0]->GetInformationObject(0);
+  vtkInformation *inInfoVof = inputVector[1]->GetInformationObject(0);
+
+  const int timestep = BackwardTimestep;
+
+  if (timestep == TargetTimeStep && Controller->GetCommunicator() != 0) {
+    GetGlobalContext(inInfoVof);
+  }
+  WaitForAdvection();
+
+  std::swap(VofGrid[0], VofGrid[1]);
+  std::swap(VofSummaries[0], VofSummaries[1]);
+  Velocity[0].Swap(Velocity[1]);
+  LoadVofTimeStep(vtkRectilinearGrid::
+		  SafeDownCast(inInfoVof->Get(vtkDataObject::DATA_OBJECT())),
+		  false, false);
+  SummarizeVofTimeStep();
+  Velocity[1].Set(vtkRectilinearGrid::
+		  SafeDownCast(inInfoVelocity->Get(vtkDataObject::DATA_OBJECT())),
+		  VelocityPrecision, NumThreads);
+
+  if (timestep == TargetTimeStep) {
+    vtkSmartPointer<vtkRectilinearGrid> components = vtkSmartPointer<vtkRectilinearGrid>::New();
+    ExtractComponents(VofGrid[1], VofSummaries[1].mask, timestep, components);
+    SeedBackwardParticles(components);
+  }
+  else {
+    // Velocity[0] belongs to the later time step, so dt is negative
+    AdvectionStats stats;
+    advectParticles(VofGrid[1], GetVofBricks(1), Velocity, Particles,
+		    GetAdvectionDeltaT(BackwardPrevTimestep, timestep),
+		    GetAdvectionParams(), stats);
+    WarnForcedSteps(stats);
+    Particles.Compact();
+    if (Controller->GetCommunicator() != 0) {
+      ExchangeParticles();
+    }
+  }
+
+  if (timestep > InitTimeStep) {
+    int stride = TimeStepStride > 1 ? TimeStepStride : 1;
+    BackwardPrevTimestep = timestep;
+    BackwardTimestep = std::max(timestep - stride, InitTimeStep);
+  }
+  else {
+    LabelCellsFromBackwardParticles(VofGrid[1], VofSummaries[1].mask);
+    Particles.Clear();
+    BackwardTimestep = -1;
+    // the forward advection loads InitTimeStep again
+    LastLoadedTimestep = -1;
+  }
+  request->Set(vtkStreamingDemandDrivenPipeline::CONTINUE_EXECUTING(), 1);
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// One particle at the center of every cell of a component; the label of
+// the component travels in the particle's id
+void vtkVofTopo::SeedBackwardParticles(vtkRectilinearGrid *components)
+{
+  vtkDataArray *labels =
+    components->GetCellData()->GetAttribute(vtkDataSetAttributes::SCALARS);
+  int nodeRes[3];
+  components->GetDimensions(nodeRes);
+  vtkDataArray *coords[3] = {components->GetXCoordinates(),
+			     components->GetYCoordinates(),
+			     components->GetZCoordinates()};
+  const int processId = Controller->GetCommunicator() != 0 ?
+    Controller->GetLocalProcessId() : 0;
+
+  Particles.Clear();
+  int idx = 0;
+  for (int k = 0; k < nodeRes[2]-1; ++k) {
+    for (int j = 0; j < nodeRes[1]-1; ++j) {
+      for (int i = 0; i < nodeRes[0]-1; ++i, ++idx) {
+	const float label = labels->GetComponent(idx, 0);
+	if (label < 0.0f) {
+	  continue;
+	}
+	float4 p = make_float4((coords[0]->GetComponent(i,0) +
+				coords[0]->GetComponent(i+1,0))*0.5f,
+			       (coords[1]->GetComponent(j,0) +
+				coords[1]->GetComponent(j+1,0))*0.5f,
+			       (coords[2]->GetComponent(k,0) +
+				coords[2]->GetComponent(k+1,0))*0.5f, 1.0f);
+	Particles.Append(p, make_float4(0.0f, 0.0f, 0.0f, 0.0f),
+			 static_cast<int>(label), processId);
+      }
+    }
+  }
+  InitVelocities(Velocity[1]);
+  NumAdvectionSteps = 0;
+}
+
+//----------------------------------------------------------------------------
+// A cell of the initial time step gets a label if the backward particles
+// in it and in its 26 neighbors all carry that label; the seeds of all
+// other cells are advected. Only one particle is seeded per cell at the
+// target, so a liquid neighbor of the mask that no particle reached may
+// belong to another component and leaves the cell ambiguous
+void vtkVofTopo::LabelCellsFromBackwardParticles(vtkRectilinearGrid *vof,
+						 const OccupancyMask &mask)
+{
+  const int MIXED = -2;
+
+  int nodeRes[3];
+  vof->GetDimensions(nodeRes);
+  const int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
+  const int numCells = cellRes[0]*cellRes[1]*cellRes[2];
+
+  RectilinearLocator locator;
+  buildLocator(vof, locator);
+
+  std::vector<int> labels(numCells, -1);
+  for (int i = 0; i < Particles.Size(); ++i) {
+    if (!Particles.IsAlive(i)) {
+      continue;
+    }
+    float4 particle = Particles.GetPosition(i);
+    double x[3] = {particle.x, particle.y, particle.z};
+    int ijk[3];
+    double pcoords[3];
+    if (!locator.FindCell(x, ijk, pcoords)) {
+      continue;
+    }
+    int idx = ijk[0] + ijk[1]*cellRes[0] + ijk[2]*cellRes[0]*cellRes[1];
+    if (labels[idx] == -1) {
+      labels[idx] = Particles.GetId(i);
+    }
+    else if (labels[idx] != Particles.GetId(i)) {
+      labels[idx] = MIXED;
+    }
+  }
+
+  // particles of neighbor processes are not seen in the ghost cells, so
+  // cells next to them stay ambiguous
+  int lo[3] = {0, 0, 0};
+  int hi[3] = {cellRes[0], cellRes[1], cellRes[2]};
+  if (Controller->GetCommunicator() != 0) {
+    int extent[NUM_SIDES];
+    vof->GetExtent(extent);
+    for (int c = 0; c < 3; ++c) {
+      if (extent[c*2+0] > GlobalExtent[c*2+0]) {
+	lo[c] = NumGhostLevels + 1;
+      }
+      if (extent[c*2+1] < GlobalExtent[c*2+1]) {
+	hi[c] = cellRes[c] - NumGhostLevels - 1;
+      }
+    }
+  }
+
+  BackwardCellLabels.assign(numCells, -1);
+  for (int k = lo[2]; k < hi[2]; ++k) {
+    for (int j = lo[1]; j < hi[1]; ++j) {
+      for (int i = lo[0]; i < hi[0]; ++i) {
+
+	const int idx = i + j*cellRes[0] + k*cellRes[0]*cellRes[1];
+	const int label = labels[idx];
+	if (label < 0) {
+	  continue;
+	}
+	bool unique = true;
+	for (int dk = -1; dk <= 1 && unique; ++dk) {
+	  for (int dj = -1; dj <= 1 && unique; ++dj) {
+	    for (int di = -1; di <= 1 && unique; ++di) {
+	      int n[3] = {i+di, j+dj, k+dk};
+	      if (n[0] < 0 || n[1] < 0 || n[2] < 0 ||
+		  n[0] >= cellRes[0] || n[1] >= cellRes[1] || n[2] >= cellRes[2]) {
+		continue;
+	      }
+	      int nlabel = labels[n[0] + n[1]*cellRes[0] + n[2]*cellRes[0]*cellRes[1]];
+	      unique = nlabel == label ||
+		(nlabel == -1 && !mask.IsLiquid(n[0], n[1], n[2]));
+	    }
+	  }
+	}
+	if (unique) {
+	  BackwardCellLabels[idx] = label;
+	}
+      }
+    }
+  }
+  HasBackwardLabels = true;
+  vtkDebugMacro(<< "Backward sweep labeled "
+		<< numCells - std::count(BackwardCellLabels.begin(),
+					 BackwardCellLabels.end(), -1)
+		<< " of " << numCells << " cells at time step " << InitTimeStep);
+}
+
+//----------------------------------------------------------------------------
+bool vtkVofTopo::UseAdaptiveRefinement() const
+{
+  // the passes are steered by the labels of the seeds
+  return AdaptiveRefinement && Refinement > 0 && ComputeComponentLabels &&
+    LabelingMode == LABELING_FORWARD && !UseFlowMaps();
+}
+
+//----------------------------------------------------------------------------
+// Called with the seeds labeled at the end of a pass. Returns true if
+// another pass at the next level is needed; otherwise the seeds are at the
+// full Refinement level, with the labels of resolved cells inherited
+bool vtkVofTopo::RefineAdaptively(std::vector<float> &particleLabels)
+{
+  if (RefinementLevel < Refinement && MarkRefinedCells()) {
+    ++RefinementLevel;
+    LastLoadedTimestep = -1;
+    return true;
+  }
+  if (RefinementLevel < Refinement) {
+    // all cells are resolved, the seeds of the full level need no advection
+    std::fill(ActiveCells.begin(), ActiveCells.end(), 0);
+    RefinementLevel = Refinement;
+    InitParticles(InitVofGrid, InitVofSummary);
+    particleLabels.clear();
+    TransferLabelsToSeeds(particleLabels);
+  }
+  vtkDebugMacro(<< "Adaptive refinement advected " << NumAdaptiveParticles
+		<< " particles for " << Seeds->GetNumberOfPoints() << " seeds");
+  RefinementLevel = -1;
+  return false;
+}
+
+//----------------------------------------------------------------------------
+// Cells are refined if two neighboring seeds of the current level, in the
+// cell or across its faces, got different labels, or if a refined cell
+// with volume fraction got no seed. The other cells keep the label of
+// their seeds. Returns true if any process refines a cell
+bool vtkVofTopo::MarkRefinedCells()
+{
+  vtkFloatArray *labels = vtkFloatArray::
+    SafeDownCast(Seeds->GetPointData()->GetArray("Labels"));
+  vtkIntArray *connectivity = vtkIntArray::
+    SafeDownCast(Seeds->GetPointData()->GetArray("Connectivity"));
+  vtkShortArray *coords = vtkShortArray::
+    SafeDownCast(Seeds->GetPointData()->GetArray("Coords"));
+  // the volume fractions may only be kept as bricks, the mask has the
+  // liquid cells either way
+  const OccupancyMask &mask = InitVofSummary.mask;
+  if (labels == 0 || connectivity == 0 || coords == 0 || mask.IsEmpty()) {
+    std::cout << __LINE__ << ": Array not found!" << std::endl;
+    return false;
+  }
+
+  int nodeRes[3];
+  InitVofGrid->GetDimensions(nodeRes);
+  const int cellRes[3] = {nodeRes[0]-1, nodeRes[1]-1, nodeRes[2]-1};
+  const int numCells = cellRes[0]*cellRes[1]*cellRes[2];
+  if (ActiveCells.empty()) {
+    ActiveCells.assign(numCells, 1);
+    CellLabels.assign(numCells, -10.0f);
+  }
+
+  const int numSeeds = Seeds->GetNumberOfPoints();
+  std::vector<int> seedCells(numSeeds);
+  for (int i = 0; i < numSeeds; ++i) {
+    int ijk[3];
+    for (int c = 0; c < 3; ++c) {
+      ijk[c] = static_cast<int>(coords->GetComponent(i, c)) >> RefinementLevel;
+    }
+    seedCells[i] = ijk[0] + ijk[1]*cellRes[0] + ijk[2]*cellRes[0]*cellRes[1];
+  }
+
+  std::vector<char> refine(numCells, 0);
+  std::vector<float> seedLabels(numCells, -10.0f);
+  for (int i = 0; i < numSeeds; ++i) {
+    const int cell = seedCells[i];
+    const float label = labels->GetValue(i);
+    if (seedLabels[cell] == -10.0f) {
+      seedLabels[cell] = label;
+    }
+    else if (seedLabels[cell] != label) {
+      refine[cell] = 1;
+    }
+    for (int c = 0; c < 3; ++c) {
+      const int neighbor = connectivity->GetComponent(i, c);
+      if (neighbor >= 0 && labels->GetValue(neighbor) != label) {
+	refine[cell] = 1;
+	refine[seedCells[neighbor]] = 1;
+      }
+    }
+  }
+
+  int numRefined = 0;
+  for (int i = 0; i < numCells; ++i) {
+    if (ActiveCells[i] && seedLabels[i] == -10.0f &&
+	mask.IsLiquid(i%cellRes[0], (i/cellRes[0])%cellRes[1],
+		      i/(cellRes[0]*cellRes[1]))) {
+      refine[i] = 1;
+    }
+    ActiveCells[i] = refine[i];
+    if (refine[i]) {
+      ++numRefined;
+    }
+    else if (seedLabels[i] != -10.0f) {
+      CellLabels[i] = seedLabels[i];
+    }
+  }
+  vtkDebugMacro(<< "Refinement level " << RefinementLevel << ": refining "
+		<< numRefined << " cells");
+
+  int anyRefined = numRefined > 0;
+  if (Controller->GetCommunicator() != 0) {
+    int anyRefinedAll = anyRefined;
+    Controller->AllReduce(&anyRefined, &anyRefinedAll, 1, vtkCommunicator::MAX_OP);
+    anyRefined = anyRefinedAll;
+  }
+  return anyRefined != 0;
+}
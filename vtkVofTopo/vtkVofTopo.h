@@ -3,13 +3,33 @@
 
 #include "vtkMultiBlockDataSetAlgorithm.h"
 #include "helper_math.h"
+#include "vofTopology.h"
+#include "checkpointCache.h"
+#include "checkpointFile.h"
+#include "flowMapCache.h"
+#include "componentCache.h"
+#include "stageTracker.h"
+#include "vtkSmartPointer.h"
 #include <map>
 #include <vector>
+#include <thread>
 
 class vtkMPIController;
 class vtkRectilinearGrid;
 class vtkPolyData;
 class vtkFloatArray;
+class vtkDataArray;
+class vtkMultiBlockDataSet;
+
+// summaries of the cells of a loaded volume fraction grid, built once per
+// time step: empty, interface and full cells, the sorted interface cells
+// and, if the "Data" array is dropped, the bricked volume fractions
+struct VofSummary
+{
+  OccupancyMask mask;
+  InterfaceIndex interfaces;
+  BrickedVolume bricks;
+};
 
 class VTK_EXPORT vtkVofTopo : public vtkMultiBlockDataSetAlgorithm
 {
@@ -36,6 +56,81 @@ public:
 
   vtkGetMacro(ComputeComponentLabels, int);
   vtkSetMacro(ComputeComponentLabels, int);
+
+  vtkGetMacro(BoundaryIsoValue, double);
+  vtkSetMacro(BoundaryIsoValue, double);
+
+  vtkGetMacro(NumThreads, int);
+  vtkSetMacro(NumThreads, int);
+
+  vtkGetMacro(Integrator, int);
+  vtkSetMacro(Integrator, int);
+
+  vtkGetMacro(IntegrationTolerance, double);
+  vtkSetMacro(IntegrationTolerance, double);
+
+  vtkGetMacro(TemporalInterpolation, int);
+  vtkSetMacro(TemporalInterpolation, int);
+
+  vtkGetMacro(CFLNumber, double);
+  vtkSetMacro(CFLNumber, double);
+
+  vtkGetMacro(TimeStepStride, int);
+  vtkSetMacro(TimeStepStride, int);
+
+  vtkGetMacro(CompactInterval, int);
+  vtkSetMacro(CompactInterval, int);
+
+  vtkGetMacro(VelocityPrecision, int);
+  vtkSetMacro(VelocityPrecision, int);
+
+  vtkGetMacro(CheckpointInterval, int);
+  vtkSetMacro(CheckpointInterval, int);
+
+  vtkGetMacro(CheckpointBudget, int);
+  vtkSetMacro(CheckpointBudget, int);
+
+  vtkGetMacro(ComponentCacheBudget, int);
+  vtkSetMacro(ComponentCacheBudget, int);
+
+  vtkGetStringMacro(CheckpointDirectory);
+  vtkSetStringMacro(CheckpointDirectory);
+
+  vtkGetMacro(RegionOfInterest, int);
+  vtkSetMacro(RegionOfInterest, int);
+
+  vtkGetMacro(RegionOfInterestMargin, double);
+  vtkSetMacro(RegionOfInterestMargin, double);
+
+  vtkGetMacro(AsyncAdvection, int);
+  vtkSetMacro(AsyncAdvection, int);
+
+  vtkGetMacro(SortInterval, int);
+  vtkSetMacro(SortInterval, int);
+
+  vtkGetMacro(CompressVof, int);
+  vtkSetMacro(CompressVof, int);
+
+  vtkGetMacro(BrickVof, int);
+  vtkSetMacro(BrickVof, int);
+
+  vtkGetMacro(TargetStride, int);
+  vtkSetMacro(TargetStride, int);
+
+  void AddTargetTimeStep(int timestep);
+  void RemoveAllTargetTimeSteps();
+
+  vtkGetMacro(FlowMapRefinement, int);
+  vtkSetMacro(FlowMapRefinement, int);
+
+  vtkGetMacro(FlowMapBudget, int);
+  vtkSetMacro(FlowMapBudget, int);
+
+  vtkGetMacro(LabelingMode, int);
+  vtkSetMacro(LabelingMode, int);
+
+  vtkGetMacro(AdaptiveRefinement, int);
+  vtkSetMacro(AdaptiveRefinement, int);
   //~GUI -------------------------------
 
 protected:
@@ -59,13 +154,51 @@ private:
   void operator=(const vtkVofTopo&);  // Not implemented.
 
   void GetGlobalContext(vtkInformation *inInfo);
-  void InitParticles(vtkRectilinearGrid *vof);
-  void InitVelocities(vtkRectilinearGrid *velocity);
+  // time step closest to the time requested downstream
+  int GetRequestedTimestep(vtkInformation *outInfo) const;
+  float GetAdvectionDeltaT(const int timestep0, const int timestep1) const;
+  AdvectionParams GetAdvectionParams() const;
+  void InitParticles(vtkRectilinearGrid *vof, const VofSummary &summary);
+  void LoadVofTimeStep(vtkRectilinearGrid *input, const bool copyCoordinates,
+		       const bool copyData);
+  // compresses VofGrid[1] and builds its summary; with BrickVof the "Data"
+  // array is replaced by the bricks
+  void SummarizeVofTimeStep();
+  // bricks of VofGrid[slot], 0 if it keeps its "Data" array
+  const BrickedVolume *GetVofBricks(const int slot) const;
+  void InitVelocities(const VelocityCache &velocity);
+  // with async the particles are advected on a background thread and
+  // WaitForAdvection has to be called before they are used
   void AdvectParticles(vtkRectilinearGrid *vof[2],
-		       vtkRectilinearGrid *velocity[2]);
+		       const VelocityCache velocity[2],
+		       const bool async);
+  void WaitForAdvection();
+  // statistics, compaction, exchange and sorting after the advection
+  void FinishAdvection();
+  void WarnForcedSteps(const AdvectionStats &stats);
+  void ResumeFromCheckpoint();
+  bool ResumeFromCheckpointFile(const int current);
+  CheckpointKey GetCheckpointKey() const;
+  std::string GetCheckpointFileName(const CheckpointKey &key) const;
+  void InitBoundaries();
   void ExchangeParticles();
-  void ExtractComponents(vtkRectilinearGrid *vof,
-			 vtkRectilinearGrid *components);
+  // Stages III-VI at timestep, the one loaded into VofGrid[1]: labels the
+  // particles with the components of the volume fractions, transfers the
+  // labels to the seeds and builds the boundaries
+  void ComputeTopology(const int timestep, vtkPolyData *particles,
+		       vtkPolyData *boundaries);
+  // Stages III-V, the labels of the particles are kept for BuildTopology
+  void LabelSeeds(const int timestep, std::vector<float> &particleLabels);
+  // Stage VI and the particles of the output
+  void BuildTopology(const std::vector<float> &particleLabels,
+		     vtkPolyData *particles, vtkPolyData *boundaries);
+  // labels of the components of vof at timestep, from the cache if all
+  // processes have them
+  void ExtractComponents(vtkRectilinearGrid *vof, const OccupancyMask &mask,
+			 const int timestep, vtkRectilinearGrid *components);
+  void ComputeComponents(vtkRectilinearGrid *vof, const OccupancyMask &mask,
+			 vtkFloatArray *labels);
+  unsigned long long GetComponentSettingsHash(vtkRectilinearGrid *vof);
 
   void LabelAdvectedParticles(vtkRectilinearGrid *components,
 			      std::vector<float> &labels);
@@ -75,6 +208,39 @@ private:
 
   void ExchangeBoundarySeedPoints(vtkPolyData *boundarySeeds);
 
+  bool IsBatchMode() const;
+  bool ParticlesResumable() const;
+  bool IsBatchTarget(const int timestep) const;
+  bool MissesTargetResults(const int timestep) const;
+  void StoreTargetResult(vtkPolyData *particles, vtkPolyData *boundaries);
+  void GetTargetResults(vtkMultiBlockDataSet *results);
+
+  // ITERATE_OVER_INIT with flow maps, see FlowMaps
+  bool UseFlowMaps() const;
+  void ScheduleFlowMaps();
+  void ComputeFlowMap(const int timestep);
+  int RequestFlowMapData(vtkInformation*,
+			 vtkInformationVector**,
+			 vtkInformationVector*);
+
+  // Stages III-VI on the particles of the last advection, see Stages
+  int RequestReusedData(vtkInformation*,
+			vtkInformationVector**,
+			vtkInformationVector*);
+  unsigned long long GetStageSignature(const StageTracker::Stage stage);
+
+  // LABELING_BACKWARD
+  int RequestBackwardData(vtkInformation*,
+			  vtkInformationVector**,
+			  vtkInformationVector*);
+  void SeedBackwardParticles(vtkRectilinearGrid *components);
+  void LabelCellsFromBackwardParticles(vtkRectilinearGrid *vof,
+				       const OccupancyMask &mask);
+
+  bool UseAdaptiveRefinement() const;
+  bool RefineAdaptively(std::vector<float> &particleLabels);
+  bool MarkRefinedCells();
+
   std::vector<double> InputTimeValues;
   
   int InitTimeStep; // time t0
@@ -96,6 +262,23 @@ private:
   // for data sets without or with incorrect time stamp information
   double TimeStepDelta;
 
+  // load only every TimeStepStride-th time step
+  int TimeStepStride;
+  int NextTimestep(int timestep) const;
+
+  // Region of interest: between the initial and the target time step only
+  // the bounding box of the particles is requested, grown by the distance
+  // the fastest particle covers in RegionOfInterestMargin time steps, one
+  // cell for the interpolation stencil and the ghost levels. The extent and
+  // nodes of the piece are taken from the last time step loaded in full
+  int RegionOfInterest;
+  double RegionOfInterestMargin;
+  bool RegionRequested; // the next time step is requested as a region
+  bool HasPieceExtent;
+  int PieceExtent[6];
+  RectilinearLocator PieceLocator;
+  bool GetRegionOfInterest(int extent[6]);
+
   // Multiprocess
   vtkMPIController* Controller;
   static const int NUM_SIDES = 6;
@@ -106,27 +289,135 @@ private:
   int NumNeighbors;
   int NumGhostLevels;
   int GlobalExtent[NUM_SIDES];
+  bool HasGlobalContext;
+  int NumLabelRounds; // of the last unifyLabelsAcrossProcesses
 
   // Seeds
   int Refinement;
   vtkPolyData *Seeds;
 
   // Particles
-  std::vector<float4> Particles;
-  std::vector<float4> Velocities;
-  std::vector<int> ParticleIds;
-  std::vector<short> ParticleProcs;
+  int NumThreads; // threads used for advection, <= 0 means all cores
+  int Integrator; // one of INTEGRATOR_* from vofTopology.h
+  double IntegrationTolerance;
+  // blend velocities of two loaded time steps and sub-cycle in between
+  int TemporalInterpolation;
+  double CFLNumber;
+  ParticleStore Particles;
+  // remove dead particles every CompactInterval advection steps, 0 never
+  int CompactInterval;
+  // sort particles in Z-order every SortInterval advection steps, 0 never
+  int SortInterval;
+  int NumAdvectionSteps;
+  // advect in the background while the next time step is loaded
+  int AsyncAdvection;
+  std::thread AdvectionThread;
+  bool AdvectionPending;
+  AdvectionStats PendingStats;
+  double AdvectionTime; // seconds spent by the last advection
+  double StallTime; // seconds spent waiting for the last advection
+  int AdvectedTimestep; // time step of the particles after the advection
+
+  // Checkpoints of the particles, every CheckpointInterval advection steps
+  // (0 never), CheckpointBudget in MB
+  CheckpointCache Checkpoints;
+  int CheckpointInterval;
+  int CheckpointBudget;
+  unsigned long long CheckpointSignature; // of the advection
+  // checkpoints are also written to files here if set, and a new run with
+  // the same key resumes from them
+  char *CheckpointDirectory;
+  unsigned long long DatasetHash;
   
+  // Unified component labels of recently labeled time steps, shared by
+  // runs with different initial time steps or refinements.
+  // ComponentCacheBudget in MB
+  ComponentCache Components;
+  int ComponentCacheBudget;
+
+  // Signatures of what the stages of the last run depended on. If only
+  // later stages are affected by a change, the particles at TargetTimeStep
+  // are kept (ReuseParticles) and only the changed stages run again on them
+  StageTracker Stages;
+  bool ReuseParticles;
+  std::vector<float> ParticleLabels;
+  vtkSmartPointer<vtkPolyData> LabeledParticles;
+
   // Temporal boundaries
+  double BoundaryIsoValue;
   vtkPolyData *Boundaries;
 
+  // Batch mode: Stages III-VI also run at TargetTimeSteps and every
+  // TargetStride time steps after InitTimeStep (0 never) during the one
+  // advection to TargetTimeStep. The seeds, particles and boundaries of
+  // every target are kept and emitted in block 3 of the output
+  std::vector<int> TargetTimeSteps;
+  int TargetStride;
+  std::map<int, vtkSmartPointer<vtkMultiBlockDataSet> > TargetResults;
+
+  // With ITERATE_OVER_INIT in a single process the seeds are moved to
+  // TargetTimeStep by composing flow maps of single time step intervals.
+  // Only the maps missing for [InitTimeStep,TargetTimeStep) are computed;
+  // the time steps loaded for them, the initial and the target time step
+  // make up FlowMapSchedule. FlowMapBudget in MB
+  FlowMapCache FlowMaps;
+  int FlowMapRefinement;
+  int FlowMapBudget;
+  unsigned long long FlowMapSettingsHash;
+  std::vector<int> FlowMapSchedule;
+  int FlowMapStep; // index into FlowMapSchedule, -1 between requests
+
+  // Labeling of the seeds: forward advects all seeds. Backward first
+  // advects one particle per component cell from TargetTimeStep back to
+  // InitTimeStep; cells whose neighborhood is reached by a single
+  // component pass its label to their seeds, and only the seeds of the
+  // other cells are advected forward
+  static const int LABELING_FORWARD = 0;
+  static const int LABELING_BACKWARD = 1;
+  int LabelingMode;
+  int BackwardTimestep; // loaded in the backward sweep, -1 if none runs
+  int BackwardPrevTimestep;
+  // cells at InitTimeStep, -1 if ambiguous
+  std::vector<int> BackwardCellLabels;
+  bool HasBackwardLabels;
+  // labels of the seeds not advected, -10 for advected ones; empty
+  // without a backward sweep
+  std::vector<float> SeedLabels;
+
+  // Adaptive refinement: passes from level 0 to Refinement, each of which
+  // advects only the seeds of cells where neighboring seeds of the previous
+  // level got different labels; the seeds of the other cells inherit the
+  // label of their cell. At most Refinement+1 passes, only with
+  // ComputeComponentLabels
+  int AdaptiveRefinement;
+  int RefinementLevel; // of the current pass, -1 if none runs
+  std::vector<char> ActiveCells; // cells advected in the current pass
+  std::vector<float> CellLabels; // of the resolved cells
+  vtkRectilinearGrid *InitVofGrid; // volume fractions at InitTimeStep
+  VofSummary InitVofSummary;
+  long long NumAdaptiveParticles; // advected in all passes
+
   // Caching  
   bool UseCache;
   int LastLoadedTimestep;
 
-  // Vof and velocity
+  // Vof and velocity, the window of the last two loaded time steps
   vtkRectilinearGrid *VofGrid[2];
-  vtkRectilinearGrid *VelocityGrid[2];
+  VofSummary VofSummaries[2];
+  // x, y and z coordinates and "Data" array of the last loaded input, their
+  // modification times and whether VofGrid shares them, see LoadVofTimeStep
+  static const int NUM_INPUT_ARRAYS = 4;
+  vtkSmartPointer<vtkDataArray> LastInputArrays[NUM_INPUT_ARRAYS];
+  vtkMTimeType LastInputMTimes[NUM_INPUT_ARRAYS];
+  bool LastInputShared[NUM_INPUT_ARRAYS];
+  size_t CopiedVofBytes; // bytes copied by the last LoadVofTimeStep
+  // keep the loaded volume fractions as signed char, see compressVof
+  int CompressVof;
+  // keep the loaded volume fractions only as BrickedVolume
+  int BrickVof;
+  // velocities of the two loaded time steps, converted from the input
+  VelocityCache Velocity[2];
+  int VelocityPrecision; // one of VELOCITY_* from velocityCache.h
 };
 
 #endif